@@ -0,0 +1,22 @@
+#ifndef ERER_BENCH_BENCH_UTIL_H_
+#define ERER_BENCH_BENCH_UTIL_H_
+
+#include <chrono>
+#include <algorithm> // for std::min
+
+// Best of `repeats` runs of f in milliseconds, the least disturbed run is the closest to the cost
+template <typename F>
+double time_ms(F &&f, int repeats)
+{
+    double best = 1e30;
+    for (int r = 0; r < repeats; ++r)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+#endif // ERER_BENCH_BENCH_UTIL_H_
@@ -0,0 +1,126 @@
+// Scene BVH at growing scene sizes: build, refit after 10% of the objects moved, frustum queries
+// against testing every box, and raycasts. Objects are small boxes scattered over a square world.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+
+#include "../src/core/bvh.h"
+#include "bench_util.h"
+
+static Core::Bounds random_box(std::mt19937 &rng, float world)
+{
+    std::uniform_real_distribution<float> pos(-world, world);
+    std::uniform_real_distribution<float> size(0.5f, 2.f);
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        float s = size(rng);
+        lo[k] = k == 1 ? pos(rng) / 20 : pos(rng); // a flat world, like most scenes
+        hi[k] = lo[k] + s;
+    }
+    return Core::Bounds::from_box(lo, hi);
+}
+
+int main(int argc, char **argv)
+{
+    int repeats = argc > 1 ? std::stoi(argv[1]) : 5;
+
+    // Camera above the ground at z = -50 looking down +z, 90 degree field of view, 0.1 to 200 units
+    float n_plane = 0.1f, f_plane = 200.f;
+    Core::Matrix4f VP{{1, 0, 0, 0},
+                      {0, 1, 0, -5},
+                      {0, 0, (f_plane + n_plane) / (f_plane - n_plane), 50 * (f_plane + n_plane) / (f_plane - n_plane) - 2 * f_plane * n_plane / (f_plane - n_plane)},
+                      {0, 0, 1, 50}};
+    Core::Frustum frustum(VP);
+
+    std::cout << "n, build ms, refit 10% ms, sah cost, bvh frustum ms, linear frustum ms, visible, raycast us" << std::endl;
+    for (int n : {100, 1000, 10000, 100000})
+    {
+        std::mt19937 rng(n);
+        float world = std::sqrt(static_cast<float>(n)) * 4; // constant density
+        std::vector<Core::Bounds> boxes;
+        for (int i = 0; i < n; ++i)
+        {
+            boxes.push_back(random_box(rng, world));
+        }
+
+        Core::Bvh<int> bvh;
+        std::vector<int> proxies(n);
+        double build = time_ms([&]()
+                               {
+                                   bvh = Core::Bvh<int>();
+                                   for (int i = 0; i < n; ++i)
+                                   {
+                                       proxies[i] = bvh.insert(i, boxes[i]);
+                                   }
+                                   bvh.rebuild();
+                               },
+                               repeats);
+
+        std::vector<int> movers;
+        for (int i = 0; i < n; i += 10)
+        {
+            movers.push_back(i);
+        }
+        double refit = time_ms([&]()
+                               {
+                                   for (int i : movers)
+                                   {
+                                       Core::Bounds b = boxes[i];
+                                       for (int k = 0; k < 3; k += 2)
+                                       {
+                                           b.min[k] += 1.f;
+                                           b.max[k] += 1.f;
+                                       }
+                                       boxes[i] = b;
+                                       bvh.move(proxies[i], b);
+                                   }
+                                   bvh.maybe_rebuild();
+                               },
+                               repeats);
+
+        size_t visible = 0, linear_visible = 0;
+        double bvh_query = time_ms([&]()
+                                   {
+                                       visible = 0;
+                                       bvh.query(frustum, [&](int)
+                                                 { ++visible; });
+                                   },
+                                   repeats);
+        double linear_query = time_ms([&]()
+                                      {
+                                          linear_visible = 0;
+                                          for (const auto &b : boxes)
+                                          {
+                                              linear_visible += frustum.test_box(b.min, b.max) != Core::Frustum::Outside;
+                                          }
+                                      },
+                                      repeats);
+        if (visible != linear_visible)
+        {
+            std::cerr << "BVH found " << visible << " boxes, the linear scan " << linear_visible << std::endl;
+            return -1;
+        }
+
+        const int rays = 1000;
+        std::uniform_real_distribution<float> angle(-1.f, 1.f);
+        size_t hits = 0;
+        double raycast = time_ms([&]()
+                                 {
+                                     hits = 0;
+                                     for (int r = 0; r < rays; ++r)
+                                     {
+                                         float origin[3] = {0.f, 0.5f, 0.f};
+                                         float dir[3] = {angle(rng), angle(rng) / 20, angle(rng)};
+                                         hits += bvh.raycast(origin, dir, 1e3f, [](int, float t_box)
+                                                             { return t_box; }) >= 0.f;
+                                     }
+                                 },
+                                 repeats);
+
+        std::cout << n << ", " << build << ", " << refit << ", " << bvh.sah_cost() << ", " << bvh_query << ", "
+                  << linear_query << ", " << visible << ", " << raycast * 1e3 / rays << std::endl;
+    }
+    return 0;
+}
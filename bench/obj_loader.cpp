@@ -0,0 +1,54 @@
+// Load time of every obj under the asset directory, single threaded and with all cores.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include "../src/utils/loader.h"
+#include "bench_util.h"
+
+// Best of `repeats` loads in seconds
+double time_load(const std::string &filename, int num_threads, int repeats, Utils::ObjMesh *mesh_p)
+{
+    return time_ms([&]()
+                   { Utils::load_obj_file(filename, mesh_p, num_threads); },
+                   repeats) / 1000;
+}
+
+int main(int argc, char **argv)
+{
+    std::string root = argc > 1 ? argv[1] : "../obj";
+    int repeats = argc > 2 ? std::stoi(argv[2]) : 5;
+
+    std::vector<std::filesystem::path> files;
+    for (auto &entry : std::filesystem::recursive_directory_iterator(root))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".obj")
+        {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+    {
+        std::cerr << "no obj file under " << root << std::endl;
+        return 1;
+    }
+
+    std::cout << "best of " << repeats << ", " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    double total_1 = 0, total_n = 0;
+    for (auto &file : files)
+    {
+        Utils::ObjMesh mesh;
+        double t1 = time_load(file.string(), 1, repeats, &mesh);
+        double tn = time_load(file.string(), 0, repeats, &mesh);
+        double mb = std::filesystem::file_size(file) / 1e6;
+        total_1 += t1;
+        total_n += tn;
+        std::cout << file.string() << ": " << mb << " MB, " << mesh.triangle_count() << " tris, " << mesh.vertex_count() << " verts, "
+                  << t1 * 1000 << " ms (1 thread), " << tn * 1000 << " ms (all), " << mb / tn << " MB/s" << std::endl;
+    }
+    std::cout << "total: " << total_1 * 1000 << " ms (1 thread), " << total_n * 1000 << " ms (all)" << std::endl;
+    return 0;
+}
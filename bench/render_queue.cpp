@@ -0,0 +1,107 @@
+// Render queue sorting at growing draw counts: LSD radix sort of 64 bit keys against std::sort
+// on the float view depth it replaces, plus recording the commands from 4 threads and merging.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <algorithm>
+
+#include "../src/core/render_queue.h"
+#include "bench_util.h"
+
+struct Draw
+{
+    float depth01;
+    uint64_t material;
+    bool transparent;
+};
+
+static uint64_t key_of(const Draw &draw)
+{
+    return Core::SortKey::make(Core::SortKey::ColorPass, draw.transparent ? Core::SortKey::TransparentLayer : Core::SortKey::OpaqueLayer, draw.material, draw.depth01);
+}
+
+int main(int argc, char **argv)
+{
+    int repeats = argc > 1 ? std::stoi(argv[1]) : 5;
+    const size_t threads = 4;
+
+    std::cout << "n, std::sort depth ms, radix record+sort ms, radix 4 threads ms" << std::endl;
+    for (size_t n : {100, 1000, 10000, 100000, 1000000})
+    {
+        std::mt19937 rng(static_cast<unsigned>(n));
+        std::uniform_real_distribution<float> depth(0.f, 1.f);
+        std::uniform_int_distribution<int> material(0, 31);
+        std::vector<Draw> draws(n);
+        for (auto &draw : draws)
+        {
+            draw = {depth(rng), static_cast<uint64_t>(material(rng)), rng() % 8 == 0};
+        }
+
+        // What the renderer did before: split by layer, then sort each by depth
+        std::vector<const Draw *> opaque, transparent;
+        double baseline = time_ms([&]()
+                                  {
+                                      opaque.clear();
+                                      transparent.clear();
+                                      for (const auto &draw : draws)
+                                      {
+                                          (draw.transparent ? transparent : opaque).push_back(&draw);
+                                      }
+                                      std::sort(opaque.begin(), opaque.end(), [](const Draw *a, const Draw *b)
+                                                { return a->depth01 < b->depth01; });
+                                      std::sort(transparent.begin(), transparent.end(), [](const Draw *a, const Draw *b)
+                                                { return a->depth01 > b->depth01; });
+                                  },
+                                  repeats);
+
+        Core::RenderQueue<const Draw *> queue;
+        double radix = time_ms([&]()
+                               {
+                                   queue.begin(1);
+                                   auto &list = queue.recorder(0);
+                                   for (const auto &draw : draws)
+                                   {
+                                       list.push_back({key_of(draw), &draw});
+                                   }
+                                   queue.sort();
+                               },
+                               repeats);
+        const auto &sorted = queue.commands();
+        for (size_t i = 1; i < sorted.size(); ++i)
+        {
+            if (sorted[i - 1].key > sorted[i].key)
+            {
+                std::cerr << "Queue not sorted at " << i << std::endl;
+                return -1;
+            }
+        }
+
+        double parallel = time_ms([&]()
+                                  {
+                                      queue.begin(threads);
+                                      std::vector<std::thread> workers;
+                                      for (size_t t = 0; t < threads; ++t)
+                                      {
+                                          workers.emplace_back([&, t]()
+                                                               {
+                                                                   auto &list = queue.recorder(t);
+                                                                   for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i)
+                                                                   {
+                                                                       list.push_back({key_of(draws[i]), &draws[i]});
+                                                                   }
+                                                               });
+                                      }
+                                      for (auto &w : workers)
+                                      {
+                                          w.join();
+                                      }
+                                      queue.sort();
+                                  },
+                                  repeats);
+
+        std::cout << n << ", " << baseline << ", " << radix << ", " << parallel << std::endl;
+    }
+    return 0;
+}
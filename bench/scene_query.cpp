@@ -0,0 +1,121 @@
+// Per-frame scene queries on a large scene: iterating every component of a type, entity lookup
+// by integer id and by name, get_component, and removing/re-adding entities.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+
+#include "../src/core/scene.h"
+#include "bench_util.h"
+
+int main(int argc, char **argv)
+{
+    int n = argc > 1 ? std::stoi(argv[1]) : 100000;
+    int repeats = argc > 2 ? std::stoi(argv[2]) : 10;
+
+    Core::Scene scene("Bench");
+    std::vector<Core::EntityId> uids;
+    std::vector<std::string> names;
+    for (int i = 0; i < n; ++i)
+    {
+        names.push_back("Entity" + std::to_string(i));
+        Core::Entity *entity = scene.add_entity(new Core::Entity(names.back()));
+        uids.push_back(entity->uid());
+        if (i % 100 == 0)
+        {
+            entity->add_component(new Core::LightComponent());
+        }
+        else
+        {
+            entity->add_component(new Core::MeshComponent());
+        }
+    }
+    std::cout << n << " entities, best of " << repeats << std::endl;
+
+    double sum = 0;
+    double t = time_ms([&]()
+                       {
+                           for (auto mesh : scene.get_all_components<Core::MeshComponent>())
+                           {
+                               sum += static_cast<double>(mesh->get_version());
+                           }
+                       },
+                       repeats);
+    std::cout << "iterate " << scene.get_all_components<Core::MeshComponent>().size() << " meshes: " << t << " ms" << std::endl;
+
+    std::mt19937 rng(1);
+    std::vector<size_t> order(n);
+    for (int i = 0; i < n; ++i)
+    {
+        order[i] = rng() % n;
+    }
+    t = time_ms([&]()
+                {
+                    for (size_t i : order)
+                    {
+                        sum += scene.get_entity(uids[i])->uid();
+                    }
+                },
+                repeats);
+    std::cout << "lookup by id: " << t * 1e6 / n << " ns" << std::endl;
+    t = time_ms([&]()
+                {
+                    for (size_t i : order)
+                    {
+                        sum += scene.get_entity(names[i])->uid();
+                    }
+                },
+                repeats);
+    std::cout << "lookup by name: " << t * 1e6 / n << " ns" << std::endl;
+    std::vector<Core::NameId> interned;
+    for (auto &name : names)
+    {
+        interned.push_back(Core::Names::intern(name));
+    }
+    t = time_ms([&]()
+                {
+                    for (size_t i : order)
+                    {
+                        sum += scene.get_entity_by_name(interned[i])->uid();
+                    }
+                },
+                repeats);
+    std::cout << "lookup by interned name: " << t * 1e6 / n << " ns" << std::endl;
+    std::vector<Core::Entity *> entities;
+    for (size_t i : order)
+    {
+        entities.push_back(scene.get_entity(uids[i]));
+    }
+    t = time_ms([&]()
+                {
+                    for (auto entity : entities)
+                    {
+                        Core::MeshComponent *mesh = entity->get_component<Core::MeshComponent>();
+                        sum += mesh != nullptr ? static_cast<double>(mesh->get_version()) : 1.;
+                    }
+                },
+                repeats);
+    std::cout << "get_component: " << t * 1e6 / n << " ns" << std::endl;
+
+    // Every 10th entity leaves and comes back with a new id
+    std::vector<Core::Entity *> churn;
+    for (int i = 0; i < n; i += 10)
+    {
+        churn.push_back(scene.get_entity(uids[i]));
+    }
+    t = time_ms([&]()
+                {
+                    for (auto entity : churn)
+                    {
+                        scene.delete_entity(entity->uid());
+                    }
+                    for (auto entity : churn)
+                    {
+                        scene.add_entity(entity);
+                    }
+                },
+                repeats);
+    std::cout << "remove + add " << churn.size() << " entities: " << t << " ms" << std::endl;
+    std::cout << "(checksum " << sum << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Texture-bound fragment throughput of the linear and tiled Image layouts.
+// Every screen pixel samples the texture through a rotated and scaled uv, like a texture mapped
+// on a diagonal triangle. Pixels are visited column by column like RasterizeSystem::Pass walks a
+// triangle bbox, so consecutive fragments step across texture rows.
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <string>
+
+#include "../src/settings.h"
+#include "../src/core/data_structure.hpp"
+#include "../src/core/image.h"
+
+using Texel = Core::RGBA8;
+
+double run(const Core::Image<Texel> &tex, int screen_w, int screen_h, float angle, int repeats, uint64_t *checksum)
+{
+    float c = std::cos(angle), s = std::sin(angle);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sum = 0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (int x = 0; x < screen_w; ++x)
+        {
+            for (int y = 0; y < screen_h; ++y)
+            {
+                float px = static_cast<float>(x) / screen_w - 0.5f;
+                float py = static_cast<float>(y) / screen_h - 0.5f;
+                float u = (c * px - s * py) * 0.7f + 0.5f;
+                float v = (s * px + c * py) * 0.7f + 0.5f;
+                Texel t = tex.sampling(u, v);
+                sum += t[0] + t[1] + t[2] + t[3];
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    *checksum = sum;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    int tex_size = argc > 1 ? std::stoi(argv[1]) : 2048;
+    int repeats = argc > 2 ? std::stoi(argv[2]) : 5;
+    const int screen_w = Settings::WIDTH, screen_h = Settings::HEIGHT;
+
+    Core::Image<Texel> linear(tex_size, tex_size);
+    for (int y = 0; y < tex_size; ++y)
+    {
+        for (int x = 0; x < tex_size; ++x)
+        {
+            linear.set(x, y, Texel(static_cast<uint8_t>(x), static_cast<uint8_t>(y), static_cast<uint8_t>(x >> 8), static_cast<uint8_t>(y >> 8)));
+        }
+    }
+    Core::Image<Texel> tiled = linear;
+    tiled.to_layout(Core::ImageLayout::Tiled);
+    Core::Image<Texel> morton = linear;
+    morton.to_layout(Core::ImageLayout::Morton);
+
+    const char *names[3] = {"linear", "tiled ", "morton"};
+    const Core::Image<Texel> *images[3] = {&linear, &tiled, &morton};
+    const float angles[2] = {0.f, static_cast<float>(PI / 4)};
+    std::cout << "texture " << tex_size << "x" << tex_size << ", screen " << screen_w << "x" << screen_h << ", " << repeats << " repeats" << std::endl;
+    for (float angle : angles)
+    {
+        uint64_t reference = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            uint64_t checksum = 0;
+            run(*images[i], screen_w, screen_h, angle, 1, &checksum); // warm up
+            double sec = run(*images[i], screen_w, screen_h, angle, repeats, &checksum);
+            if (i == 0)
+            {
+                reference = checksum;
+            }
+            double mfrags = static_cast<double>(screen_w) * screen_h * repeats / sec / 1e6;
+            std::cout << names[i] << " rotation " << angle * 180 / PI << " deg: " << sec * 1000 << " ms, " << mfrags << " Mfrag/s"
+                      << (checksum == reference ? "" : "  (MISMATCH)") << std::endl;
+        }
+    }
+    return 0;
+}
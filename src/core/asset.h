@@ -0,0 +1,294 @@
+#ifndef ERER_CORE_ASSET_H_
+#define ERER_CORE_ASSET_H_
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>     // for std::shared_ptr std::weak_ptr
+#include <future>     // for std::shared_future
+#include <mutex>
+#include <thread>
+#include <filesystem> // for std::filesystem::weakly_canonical
+
+#include "data_structure.hpp"
+#include "image.h"
+#include "mesh.h"
+#include "../utils/mapped_file.h"
+#include "../utils/tgaimage.h"
+#include "../utils/convert.h"
+#include "../utils/tga_reader.h"
+#include "../utils/thread_pool.h"
+
+namespace Core
+{
+    // Hands out immutable shared handles to meshes and textures. Assets are deduplicated by path and by
+    // content (file size, then a hash of both files only when sizes match), and the cache only keeps
+    // weak references so an asset dies with its last user.
+    // The *_async variants decode on a background loader pool and return a future of the handle.
+    class AssetManager
+    {
+    public:
+        template <typename T>
+        using Handle = std::shared_ptr<const T>;
+        template <typename T>
+        using Future = std::shared_future<Handle<T>>;
+
+    private:
+        template <typename T>
+        struct Cache
+        {
+            struct Content
+            {
+                std::weak_ptr<const T> asset;
+                std::string filename; // hashed on demand, once another file of the same size shows up
+                uint64_t hash = 0;    // 0 until then
+            };
+            std::map<std::string, std::weak_ptr<const T>> by_path;
+            std::multimap<uintmax_t, Content> by_size; // most loads find no equal size and never hash
+            std::map<std::string, Future<T>> pending;  // loads in flight, keyed by normalized path
+        };
+
+        static Cache<MeshData> meshes_;
+        static Cache<Image<RGBA8>> textures_[IMAGE_LAYOUT_COUNT]; // by ImageLayout, the same file differs per layout
+        static std::mutex mutex_; // guards both caches, never held while decoding
+
+        static Utils::ThreadPool &loader_pool()
+        {
+            static Utils::ThreadPool pool(std::max(2, static_cast<int>(std::thread::hardware_concurrency()))); // loads also wait on disk
+            return pool;
+        }
+
+        static std::string normalize_path(const std::string &filename)
+        {
+            std::error_code ec;
+            std::filesystem::path p = std::filesystem::weakly_canonical(filename, ec);
+            return ec ? filename : p.string();
+        }
+
+        // FNV-1a over the file bytes, 0 means the file can't be read
+        static uint64_t hash_file(const std::string &filename)
+        {
+            Utils::MappedFile file(filename);
+            if (!file.is_open())
+            {
+                return 0;
+            }
+            uint64_t hash = 14695981039346656037ULL;
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(file.data());
+            for (size_t i = 0; i < file.size(); ++i)
+            {
+                hash = (hash ^ p[i]) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        // Live asset loaded from key, an expired entry is dropped; the caller holds mutex_
+        template <typename T>
+        static Handle<T> find_path(Cache<T> &cache, const std::string &key)
+        {
+            auto iter = cache.by_path.find(key);
+            if (iter == cache.by_path.end())
+            {
+                return nullptr;
+            }
+            if (auto hit = iter->second.lock())
+            {
+                return hit;
+            }
+            cache.by_path.erase(iter);
+            return nullptr;
+        }
+
+        // Live asset loaded from a file with the same size and hash as filename, nullptr if none
+        template <typename T>
+        static Handle<T> find_content(Cache<T> &cache, const std::string &filename, uintmax_t size)
+        {
+            std::map<std::string, uint64_t> candidates; // path -> hash, 0 while unknown
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto range = cache.by_size.equal_range(size);
+                for (auto iter = range.first; iter != range.second;)
+                {
+                    if (iter->second.asset.expired())
+                    {
+                        iter = cache.by_size.erase(iter);
+                        continue;
+                    }
+                    candidates[iter->second.filename] = iter->second.hash;
+                    ++iter;
+                }
+            }
+            if (candidates.empty())
+            {
+                return nullptr;
+            }
+            uint64_t hash = hash_file(filename);
+            if (hash == 0)
+            {
+                return nullptr;
+            }
+            for (auto &candidate : candidates)
+            {
+                if (candidate.second == 0)
+                {
+                    candidate.second = hash_file(candidate.first);
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto range = cache.by_size.equal_range(size);
+            for (auto iter = range.first; iter != range.second; ++iter)
+            {
+                auto candidate = candidates.find(iter->second.filename);
+                if (candidate == candidates.end())
+                {
+                    continue;
+                }
+                if (iter->second.hash == 0)
+                {
+                    iter->second.hash = candidate->second;
+                }
+                auto hit = iter->second.asset.lock();
+                if (hit && iter->second.hash == hash)
+                {
+                    return hit;
+                }
+            }
+            return nullptr;
+        }
+
+        // Load on the calling thread, ignoring loads in flight
+        template <typename T, typename Loader>
+        static Handle<T> load_now(Cache<T> &cache, const std::string &filename, const std::string &key, Loader loader)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (auto hit = find_path(cache, key))
+                {
+                    return hit;
+                }
+            }
+            std::error_code ec;
+            uintmax_t size = std::filesystem::file_size(filename, ec);
+            if (!ec)
+            {
+                if (auto hit = find_content(cache, filename, size))
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    cache.by_path[key] = hit; // same content under another path
+                    return hit;
+                }
+            }
+            Handle<T> ret = std::make_shared<const T>(loader(filename));
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (auto hit = find_path(cache, key))
+            {
+                return hit; // somebody else won the race, drop our copy
+            }
+            cache.by_path[key] = ret;
+            if (!ec)
+            {
+                cache.by_size.insert({size, typename Cache<T>::Content{ret, filename}});
+            }
+            return ret;
+        }
+
+        template <typename T, typename Loader>
+        static Handle<T> load(Cache<T> &cache, const std::string &filename, Loader loader)
+        {
+            std::string key = normalize_path(filename);
+            Future<T> pending;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto iter = cache.pending.find(key);
+                if (iter != cache.pending.end())
+                {
+                    pending = iter->second;
+                }
+            }
+            return pending.valid() ? pending.get() : load_now(cache, filename, key, loader);
+        }
+
+        template <typename T, typename Loader>
+        static Future<T> load_async(Cache<T> &cache, const std::string &filename, Loader loader)
+        {
+            std::string key = normalize_path(filename);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (auto hit = find_path(cache, key))
+            {
+                std::promise<Handle<T>> ready;
+                ready.set_value(hit);
+                return ready.get_future().share();
+            }
+            auto iter = cache.pending.find(key);
+            if (iter != cache.pending.end())
+            {
+                return iter->second;
+            }
+            Future<T> ret = loader_pool().submit([&cache, filename, key, loader]()
+                                                 {
+                                                     Handle<T> handle = load_now(cache, filename, key, loader);
+                                                     std::lock_guard<std::mutex> lock(mutex_);
+                                                     cache.pending.erase(key);
+                                                     return handle; })
+                                .share();
+            cache.pending[key] = ret; // the task can't erase it before we release the lock
+            return ret;
+        }
+
+        static MeshData mesh_loader(const std::string &filename)
+        {
+            return MeshData::from_obj_file(filename);
+        }
+        static Image<RGBA8> texture_loader(const std::string &filename, ImageLayout layout)
+        {
+            Image<RGBA8> ret;
+            if (!Utils::read_tga_image(filename, &ret, layout))
+            {
+                std::cerr << "Can't load texture [" << filename << "]" << std::endl;
+                return Image<RGBA8>(1, 1); // black instead of an empty image that sampling can't handle
+            }
+            return ret;
+        }
+
+    public:
+        static Handle<MeshData> load_mesh(const std::string &filename)
+        {
+            return load(meshes_, filename, mesh_loader);
+        }
+        static Future<MeshData> load_mesh_async(const std::string &filename)
+        {
+            return load_async(meshes_, filename, mesh_loader);
+        }
+
+        // Decoded into `layout`; Tiled and Morton sample faster when the footprint crosses rows
+        static Handle<Image<RGBA8>> load_texture(const std::string &filename, ImageLayout layout = ImageLayout::Linear)
+        {
+            return load(textures_[static_cast<int>(layout)], filename, [layout](const std::string &f)
+                        { return texture_loader(f, layout); });
+        }
+        static Future<Image<RGBA8>> load_texture_async(const std::string &filename, ImageLayout layout = ImageLayout::Linear)
+        {
+            return load_async(textures_[static_cast<int>(layout)], filename, [layout](const std::string &f)
+                              { return texture_loader(f, layout); });
+        }
+
+        // 1x1 white texture for meshes without albedo
+        static std::shared_ptr<const Image<RGBA8>> default_texture()
+        {
+            static std::shared_ptr<const Image<RGBA8>> ret = []()
+            {
+                auto img = std::make_shared<Image<RGBA8>>(1, 1);
+                img->set(0, 0, RGBA8(255, 255, 255));
+                return img;
+            }();
+            return ret;
+        }
+    };
+
+    AssetManager::Cache<MeshData> AssetManager::meshes_;
+    AssetManager::Cache<Image<RGBA8>> AssetManager::textures_[IMAGE_LAYOUT_COUNT];
+    std::mutex AssetManager::mutex_;
+}
+
+#endif // ERER_CORE_ASSET_H_
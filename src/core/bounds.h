@@ -0,0 +1,208 @@
+#ifndef ERER_CORE_BOUNDS_H_
+#define ERER_CORE_BOUNDS_H_
+
+#include <cmath>
+#include <algorithm>
+#include <float.h> // for FLT_MAX
+
+#include "data_structure.hpp"
+
+namespace Core
+{
+    // Axis aligned box plus bounding sphere in plain floats, cheap to copy and test
+    struct Bounds
+    {
+        float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        float center[3] = {0.f, 0.f, 0.f}; // of the sphere
+        float radius = -1.f;               // negative for empty bounds
+
+        // Sphere centered in the box with the given radius, the half diagonal when negative
+        static Bounds from_box(const float lo[3], const float hi[3], float sphere_radius = -1.f)
+        {
+            Bounds ret;
+            float diagonal = 0.f;
+            for (int k = 0; k < 3; ++k)
+            {
+                ret.min[k] = lo[k];
+                ret.max[k] = hi[k];
+                ret.center[k] = (lo[k] + hi[k]) / 2;
+                diagonal += (hi[k] - lo[k]) * (hi[k] - lo[k]);
+            }
+            ret.radius = sphere_radius >= 0.f ? sphere_radius : std::sqrt(diagonal) / 2;
+            return ret;
+        }
+
+        bool empty() const
+        {
+            return radius < 0.f;
+        }
+
+        // Bounds of the transformed volume: the box of the transformed box, the sphere scaled by the largest axis scale
+        Bounds transformed(const Matrix4f &M) const
+        {
+            float m[3][4];
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    m[i][j] = M[i][j];
+                }
+            }
+            return transformed(m);
+        }
+
+        // Same for an affine transform given as its top 3 rows
+        Bounds transformed(const float M[3][4]) const
+        {
+            if (empty())
+            {
+                return *this;
+            }
+            Bounds ret;
+            float max_scale = 0.f;
+            for (int j = 0; j < 3; ++j)
+            {
+                max_scale = std::max(max_scale, M[0][j] * M[0][j] + M[1][j] * M[1][j] + M[2][j] * M[2][j]);
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                float box_center = M[i][3];
+                float extent = 0.f;
+                ret.center[i] = M[i][3];
+                for (int j = 0; j < 3; ++j)
+                {
+                    box_center += M[i][j] * (min[j] + max[j]) / 2;
+                    extent += std::abs(M[i][j]) * (max[j] - min[j]) / 2;
+                    ret.center[i] += M[i][j] * center[j];
+                }
+                ret.min[i] = box_center - extent;
+                ret.max[i] = box_center + extent;
+            }
+            ret.radius = radius * std::sqrt(max_scale);
+            return ret;
+        }
+
+        // Box of both, the sphere becomes the box's half diagonal
+        Bounds merged(const Bounds &other) const
+        {
+            if (empty())
+            {
+                return other;
+            }
+            if (other.empty())
+            {
+                return *this;
+            }
+            float lo[3], hi[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                lo[k] = std::min(min[k], other.min[k]);
+                hi[k] = std::max(max[k], other.max[k]);
+            }
+            return from_box(lo, hi);
+        }
+
+        bool contains(const Bounds &other) const
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                if (other.min[k] < min[k] || other.max[k] > max[k])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        float surface_area() const
+        {
+            if (empty())
+            {
+                return 0.f;
+            }
+            float d[3] = {max[0] - min[0], max[1] - min[1], max[2] - min[2]};
+            return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+        }
+    };
+
+    // View frustum as six inward facing planes n.p + d >= 0, normalized so d is a distance
+    class Frustum
+    {
+    private:
+        float planes_[6][4];
+
+    public:
+        enum Result
+        {
+            Outside = 0,
+            Intersect,
+            Inside
+        };
+
+        // Planes of -w <= x, y, z <= w in the clip space of VP (Gribb & Hartmann)
+        Frustum(const Matrix4f &VP)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int side = 0; side < 2; ++side)
+                {
+                    float *plane = planes_[axis * 2 + side];
+                    float sign = side == 0 ? 1.f : -1.f;
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        plane[k] = VP[3][k] + sign * VP[axis][k];
+                    }
+                    float n = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        plane[k] /= n;
+                    }
+                }
+            }
+        }
+
+        // Conservative: the sphere rejects cheaply, then the box corner furthest along each plane
+        Result test(const Bounds &bounds) const
+        {
+            if (bounds.empty())
+            {
+                return Outside;
+            }
+            for (const auto &plane : planes_)
+            {
+                float d = plane[0] * bounds.center[0] + plane[1] * bounds.center[1] + plane[2] * bounds.center[2] + plane[3];
+                if (d < -bounds.radius)
+                {
+                    return Outside;
+                }
+            }
+            return test_box(bounds.min, bounds.max);
+        }
+
+        Result test_box(const float lo[3], const float hi[3]) const
+        {
+            Result ret = Inside;
+            for (const auto &plane : planes_)
+            {
+                float far_d = plane[3], near_d = plane[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    far_d += plane[k] * (plane[k] >= 0 ? hi[k] : lo[k]);
+                    near_d += plane[k] * (plane[k] >= 0 ? lo[k] : hi[k]);
+                }
+                if (far_d < 0)
+                {
+                    return Outside;
+                }
+                if (near_d < 0)
+                {
+                    ret = Intersect;
+                }
+            }
+            return ret;
+        }
+    };
+}
+
+#endif // ERER_CORE_BOUNDS_H_
@@ -0,0 +1,617 @@
+#ifndef ERER_CORE_BVH_H_
+#define ERER_CORE_BVH_H_
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <float.h> // for FLT_MAX
+
+#include "bounds.h"
+
+namespace Core
+{
+    /* Dynamic bounding volume hierarchy over boxes, one item per leaf. Leaves are inserted next to
+       the sibling that grows the tree's surface area least and refit in place when their box
+       changes; once the surface area heuristic cost has degraded by rebuild_ratio since the last
+       build the whole tree is rebuilt top down with binned SAH. Proxy ids (leaf nodes) survive
+       rebuilds. */
+    template <typename T>
+    class Bvh
+    {
+    public:
+        static constexpr int NONE = -1;
+
+    private:
+        static constexpr int SAH_BINS = 16;
+
+        struct Node
+        {
+            float min[3];
+            float max[3];
+            int parent = NONE;
+            int left = NONE; // NONE for leaves
+            int right = NONE;
+            T item{};
+
+            bool is_leaf() const
+            {
+                return left == NONE;
+            }
+        };
+
+        std::vector<Node> nodes_;
+        std::vector<int> free_nodes_;
+        int root_ = NONE;
+        size_t leaf_count_ = 0;
+        float built_cost_ = 0.f;   // sah_cost() right after the last build
+        size_t changes_ = 0;       // inserts, removes and moves since the cost was last checked
+        float rebuild_ratio_ = 1.5f;
+
+        static float area(const float lo[3], const float hi[3])
+        {
+            float d[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+            return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+        }
+
+        static float union_area(const Node &a, const Node &b)
+        {
+            float lo[3], hi[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                lo[k] = std::min(a.min[k], b.min[k]);
+                hi[k] = std::max(a.max[k], b.max[k]);
+            }
+            return area(lo, hi);
+        }
+
+        int allocate()
+        {
+            if (free_nodes_.empty())
+            {
+                nodes_.emplace_back();
+                return static_cast<int>(nodes_.size() - 1);
+            }
+            int ret = free_nodes_.back();
+            free_nodes_.pop_back();
+            nodes_[ret] = Node();
+            return ret;
+        }
+
+        void release(int node)
+        {
+            nodes_[node].parent = NONE;
+            nodes_[node].left = nodes_[node].right = NONE;
+            free_nodes_.push_back(node);
+        }
+
+        void fit(int node)
+        {
+            Node &n = nodes_[node];
+            const Node &l = nodes_[n.left];
+            const Node &r = nodes_[n.right];
+            for (int k = 0; k < 3; ++k)
+            {
+                n.min[k] = std::min(l.min[k], r.min[k]);
+                n.max[k] = std::max(l.max[k], r.max[k]);
+            }
+        }
+
+        // Refit the ancestors of node up to the root
+        void refit_up(int node)
+        {
+            for (int n = nodes_[node].parent; n != NONE; n = nodes_[n].parent)
+            {
+                fit(n);
+            }
+        }
+
+        // Sibling for a new leaf: walk down to the child whose enlargement costs less (Bittner et al.)
+        int find_sibling(int leaf) const
+        {
+            int node = root_;
+            while (!nodes_[node].is_leaf())
+            {
+                const Node &n = nodes_[node];
+                float merged = union_area(n, nodes_[leaf]);
+                float here = 2 * merged;                                        // new parent at this level
+                float inherited = 2 * (merged - area(n.min, n.max));            // growth pushed to the ancestors
+                auto descend_cost = [&](int child)
+                {
+                    const Node &c = nodes_[child];
+                    float cost = union_area(c, nodes_[leaf]) + inherited;
+                    return c.is_leaf() ? cost : cost - area(c.min, c.max);
+                };
+                float left = descend_cost(n.left);
+                float right = descend_cost(n.right);
+                if (here < left && here < right)
+                {
+                    break;
+                }
+                node = left < right ? n.left : n.right;
+            }
+            return node;
+        }
+
+        void attach(int leaf)
+        {
+            if (root_ == NONE)
+            {
+                root_ = leaf;
+                nodes_[leaf].parent = NONE;
+                return;
+            }
+            int sibling = find_sibling(leaf);
+            int old_parent = nodes_[sibling].parent;
+            int parent = allocate();
+            nodes_[parent].parent = old_parent;
+            nodes_[parent].left = sibling;
+            nodes_[parent].right = leaf;
+            nodes_[sibling].parent = parent;
+            nodes_[leaf].parent = parent;
+            if (old_parent == NONE)
+            {
+                root_ = parent;
+            }
+            else if (nodes_[old_parent].left == sibling)
+            {
+                nodes_[old_parent].left = parent;
+            }
+            else
+            {
+                nodes_[old_parent].right = parent;
+            }
+            fit(parent);
+            refit_up(parent);
+        }
+
+        void detach(int leaf)
+        {
+            if (leaf == root_)
+            {
+                root_ = NONE;
+                return;
+            }
+            int parent = nodes_[leaf].parent;
+            int grand = nodes_[parent].parent;
+            int sibling = nodes_[parent].left == leaf ? nodes_[parent].right : nodes_[parent].left;
+            nodes_[sibling].parent = grand;
+            if (grand == NONE)
+            {
+                root_ = sibling;
+            }
+            else
+            {
+                (nodes_[grand].left == parent ? nodes_[grand].left : nodes_[grand].right) = sibling;
+                refit_up(sibling);
+            }
+            release(parent);
+            nodes_[leaf].parent = NONE;
+        }
+
+        // Leaf box copied next to its id, so the build sweeps contiguous memory
+        struct BuildRef
+        {
+            float min[3];
+            float max[3];
+            int leaf;
+        };
+
+        // Top down binned SAH over refs[begin, end), returns the subtree root
+        int build(std::vector<BuildRef> &refs, size_t begin, size_t end)
+        {
+            if (end - begin == 1)
+            {
+                return refs[begin].leaf;
+            }
+            float cmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, cmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (size_t i = begin; i < end; ++i)
+            {
+                const BuildRef &n = refs[i];
+                for (int k = 0; k < 3; ++k)
+                {
+                    float c = n.min[k] + n.max[k];
+                    cmin[k] = std::min(cmin[k], c);
+                    cmax[k] = std::max(cmax[k], c);
+                }
+            }
+            int axis = 0;
+            for (int k = 1; k < 3; ++k)
+            {
+                if (cmax[k] - cmin[k] > cmax[axis] - cmin[axis])
+                {
+                    axis = k;
+                }
+            }
+            size_t mid = begin + (end - begin) / 2;
+            float extent = cmax[axis] - cmin[axis];
+            if (extent > 0.f)
+            {
+                struct Bin
+                {
+                    float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+                    float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+                    size_t count = 0;
+                };
+                Bin bins[SAH_BINS];
+                auto bin_of = [&](const BuildRef &n)
+                {
+                    int b = static_cast<int>((n.min[axis] + n.max[axis] - cmin[axis]) / extent * SAH_BINS);
+                    return std::min(b, SAH_BINS - 1);
+                };
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const BuildRef &n = refs[i];
+                    Bin &b = bins[bin_of(n)];
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        b.min[k] = std::min(b.min[k], n.min[k]);
+                        b.max[k] = std::max(b.max[k], n.max[k]);
+                    }
+                    ++b.count;
+                }
+                // Sweep from the right for suffix areas, then from the left to evaluate each split
+                float right_area[SAH_BINS];
+                Bin acc;
+                for (int b = SAH_BINS - 1; b > 0; --b)
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        acc.min[k] = std::min(acc.min[k], bins[b].min[k]);
+                        acc.max[k] = std::max(acc.max[k], bins[b].max[k]);
+                    }
+                    acc.count += bins[b].count;
+                    right_area[b] = acc.count ? area(acc.min, acc.max) * acc.count : 0.f;
+                }
+                Bin left;
+                float best = FLT_MAX;
+                int best_split = NONE;
+                for (int b = 0; b < SAH_BINS - 1; ++b)
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        left.min[k] = std::min(left.min[k], bins[b].min[k]);
+                        left.max[k] = std::max(left.max[k], bins[b].max[k]);
+                    }
+                    left.count += bins[b].count;
+                    if (left.count == 0 || left.count == end - begin)
+                    {
+                        continue;
+                    }
+                    float cost = area(left.min, left.max) * left.count + right_area[b + 1];
+                    if (cost < best)
+                    {
+                        best = cost;
+                        best_split = b;
+                    }
+                }
+                if (best_split != NONE)
+                {
+                    auto it = std::partition(refs.begin() + begin, refs.begin() + end, [&](const BuildRef &n)
+                                             { return bin_of(n) <= best_split; });
+                    mid = it - refs.begin();
+                }
+            }
+            if (mid == begin || mid == end) // all centroids in one bin
+            {
+                mid = begin + (end - begin) / 2;
+            }
+            int node = allocate();
+            int l = build(refs, begin, mid);
+            int r = build(refs, mid, end);
+            nodes_[node].left = l;
+            nodes_[node].right = r;
+            nodes_[l].parent = node;
+            nodes_[r].parent = node;
+            fit(node);
+            return node;
+        }
+
+        static bool box_overlaps_sphere(const Node &n, const float c[3], float r)
+        {
+            float d2 = 0.f;
+            for (int k = 0; k < 3; ++k)
+            {
+                float d = std::max({n.min[k] - c[k], 0.f, c[k] - n.max[k]});
+                d2 += d * d;
+            }
+            return d2 <= r * r;
+        }
+
+        // Entry distance of the ray into the box, or a negative value when it misses within max_t
+        static float ray_box(const Node &n, const float o[3], const float inv_d[3], float max_t)
+        {
+            float t0 = 0.f, t1 = max_t;
+            for (int k = 0; k < 3; ++k)
+            {
+                float a = (n.min[k] - o[k]) * inv_d[k];
+                float b = (n.max[k] - o[k]) * inv_d[k];
+                t0 = std::max(t0, std::min(a, b));
+                t1 = std::min(t1, std::max(a, b));
+            }
+            return t0 <= t1 ? t0 : -1.f;
+        }
+
+        template <typename F>
+        void visit_subtree(int node, F &visit, std::vector<int> &stack) const
+        {
+            size_t base = stack.size();
+            stack.push_back(node);
+            while (stack.size() > base)
+            {
+                const Node &n = nodes_[stack.back()];
+                stack.pop_back();
+                if (n.is_leaf())
+                {
+                    visit(n.item);
+                    continue;
+                }
+                stack.push_back(n.left);
+                stack.push_back(n.right);
+            }
+        }
+
+    public:
+        // Proxy id for the item, pass it to move() and remove()
+        int insert(const T &item, const Bounds &bounds)
+        {
+            int leaf = allocate();
+            Node &n = nodes_[leaf];
+            n.item = item;
+            for (int k = 0; k < 3; ++k)
+            {
+                n.min[k] = bounds.min[k];
+                n.max[k] = bounds.max[k];
+            }
+            attach(leaf);
+            ++leaf_count_;
+            ++changes_;
+            return leaf;
+        }
+
+        void remove(int proxy)
+        {
+            detach(proxy);
+            release(proxy);
+            --leaf_count_;
+            ++changes_;
+        }
+
+        // New box of a leaf, the ancestors are refit; no-op if the box did not change
+        void move(int proxy, const Bounds &bounds)
+        {
+            Node &n = nodes_[proxy];
+            bool same = true;
+            for (int k = 0; k < 3; ++k)
+            {
+                same = same && n.min[k] == bounds.min[k] && n.max[k] == bounds.max[k];
+                n.min[k] = bounds.min[k];
+                n.max[k] = bounds.max[k];
+            }
+            if (!same)
+            {
+                refit_up(proxy);
+                ++changes_;
+            }
+        }
+
+        const T &get(int proxy) const
+        {
+            return nodes_[proxy].item;
+        }
+
+        size_t size() const
+        {
+            return leaf_count_;
+        }
+
+        Bvh *set_rebuild_ratio(float ratio)
+        {
+            rebuild_ratio_ = ratio;
+            return this;
+        }
+
+        // Expected traversal cost relative to the root: sum of internal node areas / root area
+        float sah_cost() const
+        {
+            if (root_ == NONE || nodes_[root_].is_leaf())
+            {
+                return 0.f;
+            }
+            float root_area = std::max(area(nodes_[root_].min, nodes_[root_].max), FLT_MIN);
+            float sum = 0.f;
+            std::vector<int> stack{root_};
+            while (!stack.empty())
+            {
+                const Node &n = nodes_[stack.back()];
+                stack.pop_back();
+                if (!n.is_leaf())
+                {
+                    sum += area(n.min, n.max);
+                    stack.push_back(n.left);
+                    stack.push_back(n.right);
+                }
+            }
+            return sum / root_area;
+        }
+
+        void rebuild()
+        {
+            std::vector<BuildRef> refs;
+            refs.reserve(leaf_count_);
+            std::vector<int> stack;
+            if (root_ != NONE)
+            {
+                stack.push_back(root_);
+            }
+            while (!stack.empty())
+            {
+                int node = stack.back();
+                stack.pop_back();
+                const Node &n = nodes_[node];
+                if (n.is_leaf())
+                {
+                    refs.push_back({{n.min[0], n.min[1], n.min[2]}, {n.max[0], n.max[1], n.max[2]}, node});
+                    continue;
+                }
+                stack.push_back(nodes_[node].left);
+                stack.push_back(nodes_[node].right);
+                release(node);
+            }
+            root_ = refs.empty() ? NONE : build(refs, 0, refs.size());
+            if (root_ != NONE)
+            {
+                nodes_[root_].parent = NONE;
+            }
+            built_cost_ = sah_cost();
+            changes_ = 0;
+        }
+
+        // Rebuild when enough changed since the last check and the cost grew past the ratio
+        bool maybe_rebuild()
+        {
+            if (changes_ == 0 || changes_ < leaf_count_ / 8)
+            {
+                return false;
+            }
+            changes_ = 0;
+            if (sah_cost() <= built_cost_ * rebuild_ratio_ && built_cost_ > 0.f)
+            {
+                return false;
+            }
+            rebuild();
+            return true;
+        }
+
+        // Items whose boxes intersect the frustum; subtrees entirely inside are taken without tests
+        template <typename F>
+        void query(const Frustum &frustum, F &&visit) const
+        {
+            if (root_ == NONE)
+            {
+                return;
+            }
+            std::vector<int> stack{root_};
+            std::vector<int> inside;
+            while (!stack.empty())
+            {
+                int node = stack.back();
+                stack.pop_back();
+                const Node &n = nodes_[node];
+                Frustum::Result result = frustum.test_box(n.min, n.max);
+                if (result == Frustum::Outside)
+                {
+                    continue;
+                }
+                if (result == Frustum::Inside || n.is_leaf())
+                {
+                    visit_subtree(node, visit, inside);
+                    continue;
+                }
+                stack.push_back(n.left);
+                stack.push_back(n.right);
+            }
+        }
+
+        // Items whose boxes intersect the sphere, e.g. meshes in a light's range
+        template <typename F>
+        void query(const float center[3], float radius, F &&visit) const
+        {
+            if (root_ == NONE)
+            {
+                return;
+            }
+            std::vector<int> stack{root_};
+            while (!stack.empty())
+            {
+                const Node &n = nodes_[stack.back()];
+                stack.pop_back();
+                if (!box_overlaps_sphere(n, center, radius))
+                {
+                    continue;
+                }
+                if (n.is_leaf())
+                {
+                    visit(n.item);
+                    continue;
+                }
+                stack.push_back(n.left);
+                stack.push_back(n.right);
+            }
+        }
+
+        // Items whose boxes contain the point
+        template <typename F>
+        void query(const float point[3], F &&visit) const
+        {
+            query(point, 0.f, visit);
+        }
+
+        /* Closest hit along origin + t * dir, t in [0, max_t]. hit(item, t_box) tests the item itself
+           and returns its t or a negative value for a miss; boxes are visited near to far and
+           those beyond the best hit so far are skipped. Returns the best t, negative for none. */
+        template <typename F>
+        float raycast(const float origin[3], const float dir[3], float max_t, F &&hit, T *item_p = nullptr) const
+        {
+            if (root_ == NONE)
+            {
+                return -1.f;
+            }
+            float inv_d[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                inv_d[k] = 1.f / dir[k]; // +-inf for axis parallel rays, the slab test handles it
+            }
+            float best = -1.f;
+            float t_root = ray_box(nodes_[root_], origin, inv_d, max_t);
+            if (t_root < 0.f)
+            {
+                return -1.f;
+            }
+            std::vector<std::pair<float, int>> stack{{t_root, root_}};
+            while (!stack.empty())
+            {
+                auto [t_enter, node] = stack.back();
+                stack.pop_back();
+                float limit = best >= 0.f ? best : max_t;
+                if (t_enter > limit)
+                {
+                    continue;
+                }
+                const Node &n = nodes_[node];
+                if (n.is_leaf())
+                {
+                    float t = hit(n.item, t_enter);
+                    if (t >= 0.f && t <= limit)
+                    {
+                        best = t;
+                        if (item_p != nullptr)
+                        {
+                            *item_p = n.item;
+                        }
+                    }
+                    continue;
+                }
+                float tl = ray_box(nodes_[n.left], origin, inv_d, limit);
+                float tr = ray_box(nodes_[n.right], origin, inv_d, limit);
+                // Push the farther child first so the nearer one is popped first
+                if (tl >= 0.f && tr >= 0.f)
+                {
+                    bool left_first = tl <= tr;
+                    stack.push_back(left_first ? std::make_pair(tr, n.right) : std::make_pair(tl, n.left));
+                    stack.push_back(left_first ? std::make_pair(tl, n.left) : std::make_pair(tr, n.right));
+                }
+                else if (tl >= 0.f)
+                {
+                    stack.push_back({tl, n.left});
+                }
+                else if (tr >= 0.f)
+                {
+                    stack.push_back({tr, n.right});
+                }
+            }
+            return best;
+        }
+    };
+}
+
+#endif // ERER_CORE_BVH_H_
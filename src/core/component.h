@@ -6,72 +6,214 @@
 #include <string>
 #include <typeinfo>
 #include <cmath>
+#include <algorithm> // for std::fill
+#include <memory>  // for std::shared_ptr
+#include <unordered_map>
+#include <future>  // for std::shared_future
 
 #include "data_structure.hpp"
+#include "transform.h"
 #include "shader.h"
 #include "image.h"
-#include "../utils/loader.h"
+#include "lazy_clear.h"
+#include "mesh.h"
+#include "asset.h"
 #include "../utils/math.h"
 #include "../settings.h"
 
 namespace Core
 {
+    class Scene;
+    class CameraComponent;
+
+    /* Base of everything placed in the scene. The local transform is stored as position,
+       rotation quaternion and scale; the world matrix (parent world * local) is cached and only
+       recomputed after the node or one of its ancestors changed. Changing a node marks its whole
+       subtree dirty, reading getM() recomputes what is dirty on the way down from the root. */
     class Component
     {
     protected:
-        Matrix4f T_model_;
-        Matrix4f S_model_;
-        Matrix4f R_model_;
+        float position_[3] = {0.f, 0.f, 0.f};
+        Quaternion rotation_;
+        float scale_[3] = {1.f, 1.f, 1.f};
+        Component *parent_ = nullptr;
+        std::vector<Component *> children_;
+        mutable Matrix4f world_;
+        mutable bool world_dirty_ = true;
+        mutable uint64_t world_stamp_ = 0; // bumped whenever world_ is recomputed
+        uint64_t version_ = 0; // bumped by every change that can alter the rendered image
+
+        static uint64_t hierarchy_version_; // bumped by set_parent, scenes rebuild their update order
+
+        virtual void touch()
+        {
+            ++version_;
+        }
+
+        // The subtree's world matrices are stale, and so is what they render
+        void mark_dirty()
+        {
+            touch();
+            if (world_dirty_)
+            {
+                return; // a dirty node's descendants are dirty already
+            }
+            world_dirty_ = true;
+            for (auto child : children_)
+            {
+                child->mark_dirty();
+            }
+        }
+
+        // T * R * S of the local transform
+        virtual Matrix4f local_matrix() const
+        {
+            float r[3][3];
+            rotation_.to_matrix(r);
+            Matrix4f ret = indentity<float, 4>();
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    ret[i][j] = r[i][j] * scale_[j];
+                }
+                ret[i][3] = position_[i];
+            }
+            return ret;
+        }
 
     public:
         Component()
         {
-            T_model_ = indentity<float, 4>();
-            S_model_ = indentity<float, 4>();
-            R_model_ = indentity<float, 4>();
         }
-        virtual ~Component() {} // virtual func is necessary, otherwise dynamic_cast(base->drived) will fail
+        virtual ~Component() // virtual func is necessary, otherwise dynamic_cast(base->drived) will fail
+        {
+            set_parent(nullptr);
+            for (auto child : children_)
+            {
+                child->parent_ = nullptr; // orphans become roots
+                child->mark_dirty();
+            }
+            ++hierarchy_version_;
+        }
         Component *set_position(const Vector3f &pos)
         {
-            T_model_[0][3] = pos[0];
-            T_model_[1][3] = pos[1];
-            T_model_[2][3] = pos[2];
+            for (int i = 0; i < 3; ++i)
+            {
+                position_[i] = pos[i];
+            }
+            mark_dirty();
             return this;
         }
         Component *set_scala(const Vector3f &scala)
         {
-            S_model_[0][0] = scala[0];
-            S_model_[1][1] = scala[1];
-            S_model_[2][2] = scala[2];
+            for (int i = 0; i < 3; ++i)
+            {
+                scale_[i] = scala[i];
+            }
+            mark_dirty();
             return this;
         }
+        // Rotation taking the x axis to x and the y axis to y, y is made orthogonal to x
         Component *set_rotation(const Vector3f &x, const Vector3f &y)
         {
             Vector3f w = x.normal();
-            Vector3f u = y.normal();
-            Vector3f v = Utils::cross_product_3D(w, u).normal();
-            for (int i = 0; i < 3; ++i)
+            Vector3f v = Utils::cross_product_3D(w, y.normal()).normal();
+            Vector3f u = Utils::cross_product_3D(v, w);
+            return set_rotation(Quaternion::from_basis(w, u, v));
+        }
+        Component *set_rotation(const Quaternion &rotation)
+        {
+            rotation_ = rotation.normalized();
+            mark_dirty();
+            return this;
+        }
+
+        /* Attach under parent (nullptr for a root). The local transform is kept, so the node moves
+           with the parent from now on. Refuses to create a cycle. */
+        Component *set_parent(Component *parent)
+        {
+            if (parent == parent_)
+            {
+                return this;
+            }
+            for (Component *p = parent; p != nullptr; p = p->parent_)
+            {
+                if (p == this)
+                {
+                    std::cerr << "Can't parent a component to its own descendant" << std::endl;
+                    return this;
+                }
+            }
+            if (parent_ != nullptr)
+            {
+                auto &siblings = parent_->children_;
+                siblings.erase(std::find(siblings.begin(), siblings.end(), this));
+            }
+            parent_ = parent;
+            if (parent_ != nullptr)
             {
-                R_model_[i][0] = w[i]; // x->x
-                R_model_[i][1] = u[i]; // y->y
-                R_model_[i][2] = v[i]; // z->cross(x,y)
+                parent_->children_.push_back(this);
             }
+            ++hierarchy_version_;
+            mark_dirty();
             return this;
         }
+        Component *get_parent() const
+        {
+            return parent_;
+        }
+        const std::vector<Component *> &get_children() const
+        {
+            return children_;
+        }
+        static uint64_t get_hierarchy_version()
+        {
+            return hierarchy_version_;
+        }
+
+        uint64_t get_version() const
+        {
+            return version_;
+        }
         Vector3f get_position() const
         {
-            return Vector3f{T_model_[0][3], T_model_[1][3], T_model_[2][3]};
+            return Vector3f{position_[0], position_[1], position_[2]};
         }
         Vector3f get_scala() const
         {
-            return Vector3f{S_model_[0][0], S_model_[1][1], S_model_[2][2]};
+            return Vector3f{scale_[0], scale_[1], scale_[2]};
+        }
+        Quaternion get_rotation() const
+        {
+            return rotation_;
+        }
+        Vector3f get_world_position() const
+        {
+            const Matrix4f &M = getM();
+            return Vector3f{M[0][3], M[1][3], M[2][3]};
+        }
+
+        // Recompute the cached world matrix if it is stale, the parent's first
+        void update_world() const
+        {
+            if (!world_dirty_)
+            {
+                return;
+            }
+            world_ = parent_ != nullptr ? parent_->getM().mul(local_matrix()) : local_matrix();
+            world_dirty_ = false;
+            ++world_stamp_;
         }
 
-        Matrix4f getM() const
+        // Model to world
+        const Matrix4f &getM() const
         {
-            return T_model_.mul(R_model_.mul(S_model_));
+            update_world();
+            return world_;
         }
     };
+    uint64_t Component::hierarchy_version_ = 0;
 
     class MeshComponent : public Component
     {
@@ -82,60 +224,487 @@ namespace Core
             Transparent
         } type;
 
-        float Z_view;
+        // Whether the mesh hides others in occlusion culling; Auto picks large, cheap opaque meshes
+        enum Occluder
+        {
+            AutoOccluder = 0,
+            AlwaysOccluder,
+            NeverOccluder
+        };
 
     private:
-        std::vector<VertexInput> in_vertexes_;
-        Image<Vector4c> albedo_;
+        std::shared_ptr<const MeshData> mesh_;       // shared with every component loading the same file
+        std::shared_ptr<const Image<RGBA8>> albedo_; // likewise
+        AssetManager::Future<MeshData> pending_mesh_;        // async load in flight, swapped in once ready
+        AssetManager::Future<Image<RGBA8>> pending_albedo_; // likewise
         float gloass_;
+        float opacity_ = 1.f;
+        Bounds world_bounds_;
+        const MeshData *bounds_data_ = nullptr; // mesh, world_stamp_ and version_ world_bounds_ was computed for
+        uint64_t bounds_stamp_ = 0;
+        uint64_t bounds_version_ = 0;
+        int bvh_proxy_ = -1; // leaf in the scene's mesh BVH, -1 while not in it
+        std::vector<MeshComponent *> *index_queue_ = nullptr; // the scene's meshes to refit, while in a scene
+        int index_slot_ = -1;  // position in *index_queue_, -1 while not queued
+        int scene_slot_ = -1;  // position in the scene's mesh list, so removal is a swap with the last
+        Occluder occluder_ = AutoOccluder;
+        std::unordered_map<uint64_t, size_t> lods_; // last LOD selected, by CameraComponent::get_id()
+
+        friend class Scene;
+
+        void queue_index()
+        {
+            if (index_queue_ != nullptr && index_slot_ < 0)
+            {
+                index_slot_ = static_cast<int>(index_queue_->size());
+                index_queue_->push_back(this);
+            }
+        }
+
+    protected:
+        // Every change that can move the world bounds touches, the scene refits only these meshes
+        void touch() override
+        {
+            Component::touch();
+            queue_index();
+        }
+
+        // World bounds of what is drawn, called when the mesh, the world matrix or the version changed
+        virtual Bounds compute_world_bounds(const MeshData &data) const
+        {
+            return data.get_bounds().transformed(world_);
+        }
+
+    private:
+        template <typename T>
+        static bool poll(AssetManager::Future<T> &pending, std::shared_ptr<const T> &target)
+        {
+            if (pending.valid() && pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                target = pending.get();
+                pending = AssetManager::Future<T>();
+                return true;
+            }
+            return false;
+        }
 
     public:
-        MeshComponent(MeshComponent::Type tp = MeshComponent::Type::Opaque) : gloass_(10), type(tp)
+        MeshComponent(MeshComponent::Type tp = MeshComponent::Type::Opaque) : type(tp), albedo_(AssetManager::default_texture()), gloass_(10)
         {
         }
 
         MeshComponent *load_vertexes(const std::string &filename)
         {
-            std::vector<Vector3f> positions;
-            std::vector<Vector3f> uvs;
-            std::vector<Vector3f> normals;
-            std::vector<Matrix3i> faces;
-            Utils::load_obj_file(filename, &positions, &uvs, &normals, &faces);
+            pending_mesh_ = AssetManager::Future<MeshData>();
+            mesh_ = AssetManager::load_mesh(filename);
+            bounds_data_ = nullptr;
+            touch();
+            return this;
+        }
+
+        // The mesh isn't drawn until the background load finishes
+        MeshComponent *load_vertexes_async(const std::string &filename)
+        {
+            pending_mesh_ = AssetManager::load_mesh_async(filename);
+            queue_index();
+            return this;
+        }
+
+        MeshComponent *set_albedo_texture(const std::string &filename, ImageLayout layout = ImageLayout::Linear)
+        {
+            pending_albedo_ = AssetManager::Future<Image<RGBA8>>();
+            albedo_ = AssetManager::load_texture(filename, layout);
+            touch();
+            return this;
+        }
+
+        // The default texture is the placeholder until the background decode finishes
+        MeshComponent *set_albedo_texture_async(const std::string &filename, ImageLayout layout = ImageLayout::Linear)
+        {
+            pending_albedo_ = AssetManager::load_texture_async(filename, layout);
+            queue_index();
+            return this;
+        }
+
+        MeshComponent *set_albedo_texture(const Image<RGBA8> &img)
+        {
+            pending_albedo_ = AssetManager::Future<Image<RGBA8>>();
+            albedo_ = std::make_shared<const Image<RGBA8>>(img);
+            touch();
+            return this;
+        }
 
-            VertexInput tmp;
-            for (auto f : faces)
+        // True while an async load hasn't been picked up by get_mesh_data/get_albedo_texture
+        bool is_loading() const
+        {
+            return pending_mesh_.valid() || pending_albedo_.valid();
+        }
+
+        // Block until async loads finish, for offline rendering
+        MeshComponent *wait_loaded()
+        {
+            if (pending_mesh_.valid())
             {
-                for (int i = 0; i < 3; ++i)
+                pending_mesh_.wait();
+            }
+            if (pending_albedo_.valid())
+            {
+                pending_albedo_.wait();
+            }
+            if (poll(pending_mesh_, mesh_) | poll(pending_albedo_, albedo_))
+            {
+                bounds_data_ = nullptr;
+                touch();
+            }
+            return this;
+        }
+
+        // Return nullptr until vertexes are loaded
+        const MeshData *get_mesh_data()
+        {
+            if (poll(pending_mesh_, mesh_))
+            {
+                bounds_data_ = nullptr;
+                touch();
+            }
+            return mesh_.get();
+        }
+
+        const Image<RGBA8> &get_albedo_texture()
+        {
+            if (poll(pending_albedo_, albedo_))
+            {
+                touch();
+            }
+            return *albedo_;
+        }
+
+        float get_gloss()
+        {
+            return gloass_;
+        }
+
+        // Alpha of a Transparent mesh is the albedo alpha times this
+        MeshComponent *set_opacity(float opacity)
+        {
+            opacity_ = opacity;
+            touch();
+            return this;
+        }
+
+        float get_opacity() const
+        {
+            return opacity_;
+        }
+
+        // Identity of the shading inputs (texture and gloss), meshes sharing it can be drawn together
+        uint64_t get_material_key() const
+        {
+            return reinterpret_cast<uintptr_t>(albedo_.get()) * 31 + std::hash<float>()(gloass_);
+        }
+
+        static constexpr float LOD_PIXELS_PER_TRIANGLE = 2.f; // screen area per triangle a LOD must keep
+        static constexpr float LOD_HYSTERESIS = 0.25f;       // margin on that budget before switching
+
+    protected:
+        /* Coarsest LOD of `data` that still has a triangle per LOD_PIXELS_PER_TRIANGLE pixels of the
+           bounding sphere's screen area, given its projected radius in pixels. It only moves away
+           from `previous` once the budget is LOD_HYSTERESIS past the switch point, so a mesh
+           hovering around it doesn't pop every frame. */
+        static size_t pick_lod(const MeshData *data, size_t previous, float radius_pixels)
+        {
+            float budget = static_cast<float>(PI) * radius_pixels * radius_pixels / LOD_PIXELS_PER_TRIANGLE;
+            auto coarsest = [data](float triangles)
+            {
+                size_t ret = 0;
+                while (ret + 1 < data->lod_count() && data->triangle_count(ret + 1) >= triangles)
+                {
+                    ++ret;
+                }
+                return ret;
+            };
+            return std::clamp(previous, coarsest(budget * (1 + LOD_HYSTERESIS)), coarsest(budget * (1 - LOD_HYSTERESIS)));
+        }
+
+    public:
+        // LOD for the camera whose get_id() is camera_id, see pick_lod
+        size_t select_lod(uint64_t camera_id, float radius_pixels)
+        {
+            const MeshData *data = get_mesh_data();
+            size_t &lod = lods_[camera_id];
+            if (data == nullptr)
+            {
+                return lod = 0;
+            }
+            lod = pick_lod(data, lod, radius_pixels);
+            return lod;
+        }
+
+        // LOD last selected for the camera, 0 before any
+        size_t get_lod(uint64_t camera_id) const
+        {
+            auto iter = lods_.find(camera_id);
+            if (iter == lods_.end() || mesh_ == nullptr || iter->second >= mesh_->lod_count())
+            {
+                return 0;
+            }
+            return iter->second;
+        }
+
+        MeshComponent *set_occluder(Occluder occluder)
+        {
+            occluder_ = occluder;
+            return this;
+        }
+
+        Occluder get_occluder() const
+        {
+            return occluder_;
+        }
+
+        // World space box and sphere, empty while the mesh is not loaded
+        const Bounds &get_world_bounds()
+        {
+            const MeshData *data = get_mesh_data();
+            update_world();
+            if (data != bounds_data_ || bounds_stamp_ != world_stamp_ || bounds_version_ != version_)
+            {
+                world_bounds_ = data != nullptr ? compute_world_bounds(*data) : Bounds();
+                bounds_data_ = data;
+                bounds_stamp_ = world_stamp_;
+                bounds_version_ = version_;
+            }
+            return world_bounds_;
+        }
+
+        // True for InstancedMeshComponent, which draws the mesh once per instance
+        virtual bool is_instanced() const
+        {
+            return false;
+        }
+    };
+
+    /* One mesh drawn many times: the vertexes, indices and texture are the shared assets of
+       MeshComponent, each instance only adds a transform relative to the component and a tint,
+       64 bytes in structure of arrays form. Instances are culled one by one. */
+    class InstancedMeshComponent : public MeshComponent
+    {
+    private:
+        std::vector<float> transforms_[12]; // element k of every instance's row-major 3x4 transform in transforms_[k]
+        std::vector<float> tints_[4];       // rgba, multiplies the albedo
+        std::unordered_map<uint64_t, std::vector<uint8_t>> instance_lods_; // last LOD selected per instance, by CameraComponent::get_id()
+
+        // World transform of instance i, getM() * its transform
+        void world_transform(size_t i, float m[3][4]) const
+        {
+            const Matrix4f &W = getM();
+            for (int r = 0; r < 3; ++r)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    m[r][c] = W[r][0] * transforms_[c][i] + W[r][1] * transforms_[4 + c][i] + W[r][2] * transforms_[8 + c][i] + (c == 3 ? W[r][3] : 0.f);
+                }
+            }
+        }
+
+    protected:
+        Bounds compute_world_bounds(const MeshData &data) const override
+        {
+            Bounds local = data.get_bounds();
+            float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (size_t i = 0; i < instance_count(); ++i)
+            {
+                float m[3][4];
+                world_transform(i, m);
+                Bounds b = local.transformed(m);
+                for (int k = 0; k < 3; ++k)
+                {
+                    lo[k] = std::min(lo[k], b.min[k]);
+                    hi[k] = std::max(hi[k], b.max[k]);
+                }
+            }
+            return instance_count() > 0 && !local.empty() ? Bounds::from_box(lo, hi) : Bounds();
+        }
+
+    public:
+        InstancedMeshComponent(MeshComponent::Type tp = MeshComponent::Type::Opaque) : MeshComponent(tp)
+        {
+        }
+
+        bool is_instanced() const override
+        {
+            return true;
+        }
+
+        InstancedMeshComponent *reserve_instances(size_t count)
+        {
+            for (auto &column : transforms_)
+            {
+                column.reserve(count);
+            }
+            for (auto &column : tints_)
+            {
+                column.reserve(count);
+            }
+            return this;
+        }
+
+        // Index of the new instance, transform is relative to the component
+        size_t add_instance(const Matrix4f &transform, const Vector4f &tint = Vector4f{1.f, 1.f, 1.f, 1.f})
+        {
+            for (int k = 0; k < 12; ++k)
+            {
+                transforms_[k].push_back(transform[k / 4][k % 4]);
+            }
+            for (int k = 0; k < 4; ++k)
+            {
+                tints_[k].push_back(tint[k]);
+            }
+            touch();
+            return instance_count() - 1;
+        }
+
+        size_t add_instance(const Vector3f &position, const Quaternion &rotation = Quaternion(), const Vector3f &scale = Vector3f{1.f, 1.f, 1.f}, const Vector4f &tint = Vector4f{1.f, 1.f, 1.f, 1.f})
+        {
+            float r[3][3];
+            rotation.normalized().to_matrix(r);
+            Matrix4f transform = indentity<float, 4>();
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 3; ++j)
                 {
-                    tmp.MS_POSITION = positions[f[0][i]].reshape<4>(1);
-                    tmp.UV = uvs[f[1][i]];
-                    tmp.MS_NORMAL = normals[f[2][i]];
-                    in_vertexes_.push_back(tmp);
+                    transform[i][j] = r[i][j] * scale[j];
                 }
+                transform[i][3] = position[i];
+            }
+            return add_instance(transform, tint);
+        }
+
+        InstancedMeshComponent *set_instance_transform(size_t i, const Matrix4f &transform)
+        {
+            for (int k = 0; k < 12; ++k)
+            {
+                transforms_[k][i] = transform[k / 4][k % 4];
             }
-            assert(in_vertexes_.size() == faces.size() * 3);
+            touch();
             return this;
         }
 
-        MeshComponent *set_albedo_texture(const Image<Vector4c> &img)
+        InstancedMeshComponent *set_instance_tint(size_t i, const Vector4f &tint)
         {
-            albedo_ = img;
+            for (int k = 0; k < 4; ++k)
+            {
+                tints_[k][i] = tint[k];
+            }
+            touch();
             return this;
         }
 
-        const std::vector<VertexInput> &get_all_vertexes()
+        // The last instance takes the index of the removed one
+        InstancedMeshComponent *remove_instance(size_t i)
         {
-            return in_vertexes_;
+            for (auto &column : transforms_)
+            {
+                column[i] = column.back();
+                column.pop_back();
+            }
+            for (auto &column : tints_)
+            {
+                column[i] = column.back();
+                column.pop_back();
+            }
+            for (auto &camera_lods : instance_lods_)
+            {
+                std::vector<uint8_t> &lods = camera_lods.second;
+                if (i < lods.size())
+                {
+                    lods[i] = lods.size() > instance_count() ? lods.back() : 0; // the last one's, if selected
+                    lods.resize(std::min(lods.size(), instance_count()));
+                }
+            }
+            touch();
+            return this;
         }
 
-        const Image<Vector4c> &get_albedo_texture()
+        InstancedMeshComponent *clear_instances()
         {
-            return albedo_;
+            for (auto &column : transforms_)
+            {
+                column.clear();
+            }
+            for (auto &column : tints_)
+            {
+                column.clear();
+            }
+            instance_lods_.clear();
+            touch();
+            return this;
         }
 
-        float get_gloss()
+        size_t instance_count() const
         {
-            return gloass_;
+            return tints_[0].size();
+        }
+
+        Matrix4f get_instance_transform(size_t i) const
+        {
+            Matrix4f ret = indentity<float, 4>();
+            for (int k = 0; k < 12; ++k)
+            {
+                ret[k / 4][k % 4] = transforms_[k][i];
+            }
+            return ret;
+        }
+
+        Vector4f get_instance_tint(size_t i) const
+        {
+            return Vector4f{tints_[0][i], tints_[1][i], tints_[2][i], tints_[3][i]};
+        }
+
+        // Model to world of instance i
+        Matrix4f get_instance_world_matrix(size_t i) const
+        {
+            float m[3][4];
+            world_transform(i, m);
+            Matrix4f ret = indentity<float, 4>();
+            for (int r = 0; r < 3; ++r)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    ret[r][c] = m[r][c];
+                }
+            }
+            return ret;
+        }
+
+        // LOD of instance i for the camera whose get_id() is camera_id, with the hysteresis of select_lod
+        size_t select_instance_lod(uint64_t camera_id, size_t i, float radius_pixels)
+        {
+            const MeshData *data = get_mesh_data();
+            std::vector<uint8_t> &lods = instance_lods_[camera_id];
+            if (lods.size() < instance_count())
+            {
+                lods.resize(instance_count(), 0);
+            }
+            if (data == nullptr)
+            {
+                return lods[i] = 0;
+            }
+            lods[i] = static_cast<uint8_t>(pick_lod(data, lods[i], radius_pixels)); // MAX_MESH_LODS fits
+            return lods[i];
+        }
+
+        // World box and sphere of instance i, empty while the mesh is not loaded
+        Bounds get_instance_world_bounds(size_t i)
+        {
+            const MeshData *data = get_mesh_data();
+            if (data == nullptr)
+            {
+                return Bounds();
+            }
+            float m[3][4];
+            world_transform(i, m);
+            return data->get_bounds().transformed(m);
         }
     };
 
@@ -149,33 +718,121 @@ namespace Core
         } type;
 
     private:
-        uint8_t *color_buffer_;
+        static uint64_t next_id_;
+        uint64_t id_ = next_id_++; // never reused, unlike the address of a deleted camera
+        std::vector<Image<RGBA8>> color_targets_; // packed rgba, rows from bottom to top as glDrawPixels expects
+        std::vector<LazyClear<RGBA8>> color_clears_; // one per color target
+        std::vector<int64_t> target_frames_; // frame last rendered into each color target, -1 if its content is unusable
+        int back_ = 0;   // color target being rendered
+        int front_ = -1; // color target last presented, -1 before the first present
+        int64_t frame_ = 0;
+        int target_age_ = 0;
+        bool depth_valid_ = false; // depth buffer holds the last frame
         Image<float> depth_buffer_; // assuming that all depth is larger than 0
+        LazyClear<float> depth_clear_;
+        std::vector<float> oit_accum_;     // weighted premultiplied rgb and weighted alpha of transparent fragments, 4 per pixel
+        std::vector<float> oit_revealage_; // product of (1 - alpha), 1 where nothing transparent was drawn
+        int width_;
+        int height_;
+        float tan_half_h_per_aspect_; // tan(horizontal angle / 2) / (width / height), kept by resize
 
         float near_;
         float far_;
         float vertical_angle_of_view_;
         float horizontal_angle_of_view_;
 
-        Matrix4f R_view_;
-        Matrix4f T_view_;
+        Matrix4f basis_; // orientation, set by lookat; it is left-handed so not a quaternion
+        mutable Matrix4f view_;
+        mutable uint64_t view_stamp_ = 0; // world_stamp_ view_ was computed for
         Matrix4f M_persp2ortho_;
         Matrix4f M_ortho_;
 
+        // T * basis, scale does not apply to cameras
+        Matrix4f local_matrix() const override
+        {
+            Matrix4f ret = basis_;
+            for (int i = 0; i < 3; ++i)
+            {
+                ret[i][3] = position_[i];
+            }
+            return ret;
+        }
+
     public:
         CameraComponent(CameraComponent::Type tp, float n = 0.1f, float f = 20.f, float va = 90.f, float ha = 90.f)
-            : near_(n), far_(f), vertical_angle_of_view_(va), horizontal_angle_of_view_(ha), type(tp)
+            : type(tp), width_(Settings::WIDTH), height_(Settings::HEIGHT), near_(n), far_(f), vertical_angle_of_view_(va), horizontal_angle_of_view_(ha)
         {
+            basis_ = indentity<float, 4>();
             if (type == CameraComponent::Type::ColorCamera)
             {
-                color_buffer_ = new uint8_t[Settings::WIDTH * Settings::HEIGHT * 3];
+                color_targets_.emplace_back(width_, height_);
+                color_clears_.emplace_back(width_, height_);
+                target_frames_.push_back(-1);
             }
-            depth_buffer_ = Image<float>(Settings::WIDTH, Settings::HEIGHT);
+            depth_buffer_ = Image<float>(width_, height_);
+            depth_clear_.reset(width_, height_);
+            tan_half_h_per_aspect_ = static_cast<float>(std::tan(horizontal_angle_of_view_ / 360 * PI)) * height_ / width_;
             // near/far is keyword in the windows system! near_sp/far_sp is a substitute for near/far
             M_persp2ortho_ = Matrix4f{{near_, 0, 0, 0}, {0, near_, 0, 0}, {0, 0, near_ + far_, -near_ * far_}, {0, 0, 1, 0}};
+            update_ortho();
+        }
+
+        void update_ortho()
+        {
             M_ortho_ = Matrix4f{{static_cast<float>(1 / (near_ * std::tan(horizontal_angle_of_view_ / 360 * PI))), 0, 0, 0}, {0, static_cast<float>(1 / (near_ * std::tan(vertical_angle_of_view_ / 360 * PI))), 0, 0}, {0, 0, 2 / (far_ - near_), -(near_ + far_) / (far_ - near_)}, {0, 0, 0, 1}};
         }
 
+        /* Reallocate the render targets at w x h, their content is lost. A color camera keeps its
+           vertical angle of view and widens/narrows the horizontal one with the aspect ratio so the
+           image is not stretched; a depth camera keeps its frustum and only changes texel density.
+           Not safe while a frame renders. */
+        CameraComponent *resize(int w, int h)
+        {
+            assert(w > 0 && h > 0);
+            if (w == width_ && h == height_)
+            {
+                return this;
+            }
+            if (type == CameraComponent::Type::ColorCamera)
+            {
+                horizontal_angle_of_view_ = static_cast<float>(std::atan(tan_half_h_per_aspect_ * w / h) * 360 / PI);
+                update_ortho();
+            }
+            width_ = w;
+            height_ = h;
+            for (size_t i = 0; i < color_targets_.size(); ++i)
+            {
+                color_targets_[i] = Image<RGBA8>(w, h);
+                color_clears_[i].reset(w, h);
+                target_frames_[i] = -1;
+            }
+            back_ = 0;
+            front_ = -1;
+            depth_buffer_ = Image<float>(w, h);
+            depth_clear_.reset(w, h);
+            depth_valid_ = false;
+            oit_accum_.clear(); // reallocated by the next transparent fragment
+            oit_revealage_.clear();
+            touch();
+            return this;
+        }
+
+        // Unique over the program's run, for per-camera state kept outside the camera
+        uint64_t get_id() const
+        {
+            return id_;
+        }
+
+        int get_width() const
+        {
+            return width_;
+        }
+
+        int get_height() const
+        {
+            return height_;
+        }
+
         CameraComponent *lookat(const Vector3f &gaze, const Vector3f &up)
         {
             Vector3f w = gaze.normal();
@@ -183,15 +840,11 @@ namespace Core
             Vector3f v = Utils::cross_product_3D(w, u).normal();
             for (int i = 0; i < 3; ++i)
             {
-                R_model_[i][0] = v[i]; // x->cross(gaze,up)
-                R_model_[i][1] = u[i]; // y->up
-                R_model_[i][2] = w[i]; // z->gaze
+                basis_[i][0] = v[i]; // x->cross(gaze,up)
+                basis_[i][1] = u[i]; // y->up
+                basis_[i][2] = w[i]; // z->gaze
             }
-            R_view_ = R_model_.transpose();
-            T_view_ = T_model_;
-            T_view_[0][3] *= -1;
-            T_view_[1][3] *= -1;
-            T_view_[2][3] *= -1;
+            mark_dirty();
             return this;
         }
 
@@ -202,39 +855,76 @@ namespace Core
             Vector3f u = Utils::cross_product_3D(v, w).normal();
             for (int i = 0; i < 3; ++i)
             {
-                R_model_[i][0] = v[i]; // x->gaze's horizontal orthogonal vector(hov)
-                R_model_[i][1] = u[i]; // y->cross(hov,gaze)
-                R_model_[i][2] = w[i]; // z->gaze
+                basis_[i][0] = v[i]; // x->gaze's horizontal orthogonal vector(hov)
+                basis_[i][1] = u[i]; // y->cross(hov,gaze)
+                basis_[i][2] = w[i]; // z->gaze
             }
-            R_view_ = R_model_.transpose();
+            mark_dirty();
             return this;
         }
 
         // override function due to covariant return type
         CameraComponent *set_position(const Vector3f &pos)
         {
-            T_model_[0][3] = pos[0];
-            T_model_[1][3] = pos[1];
-            T_model_[2][3] = pos[2];
-            T_view_ = T_model_;
-            T_view_[0][3] *= -1;
-            T_view_[1][3] *= -1;
-            T_view_[2][3] *= -1;
+            Component::set_position(pos);
             return this;
         }
 
+        // Lazy clear, tiles take the clear value when first written or on resolve_buffers()
         void flush_buffer()
         {
             if (type == CameraComponent::Type::ColorCamera)
             {
-                memset(color_buffer_, 0U, Settings::WIDTH * Settings::HEIGHT * 3);
+                color_clears_[back_].clear(RGBA8(0, 0, 0, 0));
+            }
+            depth_clear_.clear(far_);
+        }
+
+        // Clear color and depth inside [x0, x1) x [y0, y1) only, for incremental frames
+        void clear_rect(int x0, int y0, int x1, int y1)
+        {
+            resolve_buffers();
+            for (int y = y0; y < y1; ++y)
+            {
+                if (type == CameraComponent::Type::ColorCamera)
+                {
+                    RGBA8 *row = color_targets_[back_].data() + y * width_;
+                    std::fill(row + x0, row + x1, RGBA8(0, 0, 0, 0));
+                }
+                float *row = depth_buffer_.data() + y * width_;
+                std::fill(row + x0, row + x1, far_);
+            }
+        }
+
+        // Fill the tiles no fragment touched, needed before the buffers are read as whole images
+        void resolve_buffers()
+        {
+            if (type == CameraComponent::Type::ColorCamera)
+            {
+                color_clears_[back_].resolve(color_targets_[back_]);
             }
-            depth_buffer_.memset(far_);
+            depth_clear_.resolve(depth_buffer_);
         }
 
-        Matrix4f getV()
+        // World to view, cached until the camera or one of its ancestors moves
+        const Matrix4f &getV()
         {
-            return R_view_.mul(T_view_);
+            update_world();
+            if (view_stamp_ != world_stamp_)
+            {
+                Matrix4f T_view = indentity<float, 4>();
+                for (int i = 0; i < 3; ++i)
+                {
+                    T_view[i][3] = -position_[i];
+                }
+                view_ = basis_.transpose().mul(T_view);
+                if (parent_ != nullptr)
+                {
+                    view_ = view_.mul(affine_inverse(parent_->getM()));
+                }
+                view_stamp_ = world_stamp_;
+            }
+            return view_;
         }
 
         Matrix4f getP()
@@ -244,7 +934,12 @@ namespace Core
 
         Matrix4f getVP()
         {
-            return M_ortho_.mul(M_persp2ortho_.mul(R_view_.mul(T_view_)));
+            return M_ortho_.mul(M_persp2ortho_.mul(getV()));
+        }
+
+        Matrix4f getViewPort()
+        {
+            return getViewPort(Vector2i{width_, height_});
         }
 
         Matrix4f getViewPort(const Vector2i &screen)
@@ -254,9 +949,19 @@ namespace Core
             return T.mul(S);
         }
 
+        // World position seen at pixel (sx, sy) with the given view depth, inverse of the Pass transform
+        Vector3f unproject(float sx, float sy, float view_depth)
+        {
+            float ndc_x = sx / (width_ / 2.f) - 1;
+            float ndc_y = sy / (height_ / 2.f) - 1;
+            Vector4f view{ndc_x * view_depth / (M_ortho_[0][0] * near_), ndc_y * view_depth / (M_ortho_[1][1] * near_), view_depth, 1};
+            return getM().mul(view).reshape<3>();
+        }
+
         Vector3f get_lookat_dir()
         {
-            return Vector3f{R_model_[0][2], R_model_[1][2], R_model_[2][2]}.normal();
+            const Matrix4f &M = getM();
+            return Vector3f{M[0][2], M[1][2], M[2][2]}.normal();
         }
 
         float get_near()
@@ -272,28 +977,192 @@ namespace Core
         uint8_t *get_color_buffer()
         {
             assert(type == CameraComponent::Type::ColorCamera);
-            return color_buffer_;
+            color_clears_[back_].resolve(color_targets_[back_]);
+            return reinterpret_cast<uint8_t *>(color_targets_[back_].data());
+        }
+
+        void set_color_buffer(int x, int y, const RGBA8 &value)
+        {
+            assert(type == CameraComponent::Type::ColorCamera);
+            color_clears_[back_].set(color_targets_[back_], x, y, value);
         }
 
-        void set_color_buffer(int x, int y, Vector4c value)
+        /* Weighted blended order independent transparency (McGuire & Bavoil 2013): a transparent
+           fragment adds its premultiplied color and alpha, weighted to favour the ones near the
+           camera, and multiplies the revealage by 1 - alpha. Order doesn't matter, so transparent
+           meshes are not sorted and intersecting ones blend per pixel. */
+        void accumulate_transparent(int x, int y, const RGBA8 &color, float alpha, float view_depth)
         {
             assert(type == CameraComponent::Type::ColorCamera);
-            // rgb -> bgr
-            color_buffer_[(y * Settings::WIDTH + x) * 3] = value[2];
-            color_buffer_[(y * Settings::WIDTH + x) * 3 + 1] = value[1];
-            color_buffer_[(y * Settings::WIDTH + x) * 3 + 2] = value[0];
+            if (oit_revealage_.empty())
+            {
+                oit_accum_.assign(static_cast<size_t>(width_) * height_ * 4, 0.f);
+                oit_revealage_.assign(static_cast<size_t>(width_) * height_, 1.f);
+            }
+            alpha = std::clamp(alpha, 0.f, 1.f);
+            float z = view_depth;
+            float weight = alpha * std::clamp(10.f / (1e-5f + std::pow(z / 5, 2.f) + std::pow(z / 200, 6.f)), 1e-2f, 3e3f); // eq. 7 of the paper
+            size_t i = static_cast<size_t>(y) * width_ + x;
+            float *accum = oit_accum_.data() + 4 * i;
+            for (int k = 0; k < 3; ++k)
+            {
+                accum[k] += color[k] / 255.f * weight;
+            }
+            accum[3] += weight;
+            oit_revealage_[i] *= 1 - alpha;
+        }
+
+        // Composite the transparent fragments of [x0, x1) x [y0, y1) over the opaque color and reset the targets there
+        void resolve_transparency(int x0, int y0, int x1, int y1)
+        {
+            if (oit_revealage_.empty())
+            {
+                return;
+            }
+            for (int y = y0; y < y1; ++y)
+            {
+                for (int x = x0; x < x1; ++x)
+                {
+                    size_t i = static_cast<size_t>(y) * width_ + x;
+                    float revealage = oit_revealage_[i];
+                    float *accum = oit_accum_.data() + 4 * i;
+                    if (accum[3] <= 0.f)
+                    {
+                        continue; // nothing transparent here
+                    }
+                    RGBA8 opaque = color_clears_[back_].get(color_targets_[back_], x, y);
+                    RGBA8 out;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        float c = accum[k] / std::max(accum[3], 1e-5f) * 255 * (1 - revealage) + opaque[k] * revealage;
+                        out[k] = static_cast<uint8_t>(std::clamp(c + 0.5f, 0.f, 255.f));
+                    }
+                    out[3] = static_cast<uint8_t>(std::clamp(255 * (1 - revealage) + opaque[3] * revealage + 0.5f, 0.f, 255.f));
+                    color_clears_[back_].set(color_targets_[back_], x, y, out);
+                    std::fill(accum, accum + 4, 0.f);
+                    oit_revealage_[i] = 1.f;
+                }
+            }
         }
 
+        // Whole depth image for sampling (shadow maps), resolved once per clear
         Image<float> &get_depth_buffer()
         {
+            depth_clear_.resolve(depth_buffer_);
             return depth_buffer_;
         }
 
+        // Single depth texel for the depth test, reads through the clear state
+        float get_depth(int x, int y) const
+        {
+            return depth_clear_.get(depth_buffer_, x, y);
+        }
+
         void set_depth_buffer(int x, int y, float value)
         {
-            depth_buffer_.set(x, y, value); // view space depth with correction
+            depth_clear_.set(depth_buffer_, x, y, value); // view space depth with correction
+        }
+
+        // Hand the finished buffer over without copying, the camera keeps rendering into `other`
+        void swap_color_buffer(Image<RGBA8> &other)
+        {
+            assert(type == CameraComponent::Type::ColorCamera);
+            assert(other.get_width() == color_targets_[back_].get_width() && other.get_height() == color_targets_[back_].get_height());
+            color_clears_[back_].resolve(color_targets_[back_]);
+            std::swap(color_targets_[back_], other);
+            target_frames_[back_] = -1;
+        }
+
+        /* N-buffered color targets: the renderer acquires a target at the start of a frame and the
+           front end presents it when done. The presented target is never acquired, so it can be
+           shown or captured while the next frame renders. */
+        CameraComponent *set_target_count(int n)
+        {
+            assert(type == CameraComponent::Type::ColorCamera && n > 0);
+            color_targets_.resize(n);
+            color_clears_.resize(n);
+            target_frames_.assign(n, -1);
+            for (int i = 0; i < n; ++i)
+            {
+                if (color_targets_[i].data() == nullptr)
+                {
+                    color_targets_[i] = Image<RGBA8>(width_, height_);
+                    color_clears_[i].reset(width_, height_);
+                }
+            }
+            back_ = 0;
+            front_ = -1;
+            return this;
+        }
+
+        int get_target_count() const
+        {
+            return static_cast<int>(color_targets_.size());
+        }
+
+        // Start a frame: move rendering to the next target that is not being presented
+        void acquire_target()
+        {
+            int n = static_cast<int>(color_targets_.size());
+            if (n > 1)
+            {
+                do
+                {
+                    back_ = (back_ + 1) % n;
+                } while (back_ == front_);
+            }
+            int64_t last = n > 0 ? target_frames_[back_] : frame_ - 1; // depth cameras only keep the depth buffer
+            target_age_ = (last < 0 || !depth_valid_) ? 0 : static_cast<int>(frame_ - last);
+            if (n > 0)
+            {
+                target_frames_[back_] = frame_;
+            }
+            depth_valid_ = true; // the frame started here rewrites whatever the age says is stale
+            ++frame_;
+        }
+
+        /* Frames since the acquired target was last rendered, 0 if its content can't be reused.
+           An incremental frame must repaint everything that changed during that many frames. */
+        int get_target_age() const
+        {
+            return target_age_;
+        }
+
+        // Mark the finished frame as the one to show, call once the pass that rendered it returned
+        void present()
+        {
+            color_clears_[back_].resolve(color_targets_[back_]);
+            front_ = back_;
+        }
+
+        const uint8_t *get_presented_color_buffer()
+        {
+            assert(type == CameraComponent::Type::ColorCamera);
+            if (front_ < 0)
+            {
+                return get_color_buffer();
+            }
+            return reinterpret_cast<const uint8_t *>(color_targets_[front_].data());
+        }
+
+        // Like swap_color_buffer for the presented target, safe while the next frame renders
+        void swap_presented_color_buffer(Image<RGBA8> &other)
+        {
+            assert(type == CameraComponent::Type::ColorCamera && front_ >= 0);
+            assert(other.get_width() == color_targets_[front_].get_width() && other.get_height() == color_targets_[front_].get_height());
+            std::swap(color_targets_[front_], other);
+            target_frames_[front_] = -1;
+        }
+
+        void swap_depth_buffer(Image<float> &other)
+        {
+            assert(other.get_width() == depth_buffer_.get_width() && other.get_height() == depth_buffer_.get_height());
+            depth_clear_.resolve(depth_buffer_);
+            std::swap(depth_buffer_, other);
+            depth_valid_ = false;
         }
     };
+    uint64_t CameraComponent::next_id_ = 1;
 
     class LightComponent : public Component
     {
@@ -312,11 +1181,13 @@ namespace Core
         LightComponent *set_light_dir(const Vector3f &light_dir)
         {
             light_dir_ = light_dir;
+            touch();
             return this;
         }
         LightComponent *set_intensity(float intensity)
         {
             light_intensity_ = intensity;
+            touch();
             return this;
         }
 
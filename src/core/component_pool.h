@@ -0,0 +1,190 @@
+#ifndef ERER_CORE_COMPONENT_POOL_H_
+#define ERER_CORE_COMPONENT_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <iostream>
+#include <cstdlib> // for exit
+#include <cstdint>
+#include <cstddef> // for size_t
+
+namespace Core
+{
+    class Entity;
+
+    using EntityId = uint32_t; // assigned by the scene, never reused within it
+    constexpr EntityId INVALID_ENTITY = 0;
+
+    // Size of the per-entity component table, raise it when adding component types
+    constexpr size_t MAX_COMPONENT_TYPES = 16;
+
+    inline size_t next_component_type_id()
+    {
+        static size_t next = 0;
+        if (next == MAX_COMPONENT_TYPES)
+        {
+            std::cerr << "More than " << MAX_COMPONENT_TYPES << " component types, raise MAX_COMPONENT_TYPES" << std::endl;
+            exit(-1);
+        }
+        return next++;
+    }
+
+    // Dense id of a component type, handed out the first time the type is used
+    template <typename T>
+    size_t component_type_id()
+    {
+        static const size_t id = next_component_type_id();
+        return id;
+    }
+
+    // Interned strings: hot paths keep the integer and skip hashing the string every time
+    using NameId = uint32_t;
+
+    class Names
+    {
+    private:
+        static std::unordered_map<std::string, NameId> ids_;
+        static std::deque<std::string> strings_; // stable references for str()
+        static std::mutex mutex_;
+
+    public:
+        static NameId intern(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto iter = ids_.find(name);
+            if (iter != ids_.end())
+            {
+                return iter->second;
+            }
+            NameId id = static_cast<NameId>(strings_.size());
+            strings_.push_back(name);
+            ids_.emplace(name, id);
+            return id;
+        }
+
+        static const std::string &str(NameId id)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return strings_[id];
+        }
+    };
+    std::unordered_map<std::string, NameId> Names::ids_;
+    std::deque<std::string> Names::strings_;
+    std::mutex Names::mutex_;
+
+    // Stable reference into a pool, stays valid while other components come and go
+    struct ComponentHandle
+    {
+        uint32_t index = UINT32_MAX; // slot in the pool's sparse table
+        uint32_t generation = 0;     // bumped when the slot is freed, stale handles stop matching
+
+        bool valid() const
+        {
+            return index != UINT32_MAX;
+        }
+    };
+
+    class ComponentPoolBase
+    {
+    public:
+        virtual ~ComponentPoolBase()
+        {
+        }
+        virtual void remove(ComponentHandle handle) = 0;
+        virtual size_t size() const = 0;
+    };
+
+    /* All components of one type in a scene, packed in a dense array so systems iterate them
+       without gaps. Removing one moves the last component into its place; handles go through a
+       sparse slot table and keep pointing at the same component. Adding or removing components
+       invalidates references to components(). */
+    template <typename T>
+    class ComponentPool : public ComponentPoolBase
+    {
+    private:
+        struct Slot
+        {
+            uint32_t dense = UINT32_MAX; // position in dense_, UINT32_MAX when free
+            uint32_t generation = 0;
+        };
+
+        std::vector<T *> dense_;
+        std::vector<Entity *> owners_;        // parallel to dense_
+        std::vector<uint32_t> dense_to_slot_; // parallel to dense_
+        std::vector<Slot> slots_;
+        std::vector<uint32_t> free_slots_;
+
+    public:
+        ComponentHandle add(T *component, Entity *owner)
+        {
+            uint32_t index;
+            if (free_slots_.empty())
+            {
+                index = static_cast<uint32_t>(slots_.size());
+                slots_.emplace_back();
+            }
+            else
+            {
+                index = free_slots_.back();
+                free_slots_.pop_back();
+            }
+            slots_[index].dense = static_cast<uint32_t>(dense_.size());
+            dense_.push_back(component);
+            owners_.push_back(owner);
+            dense_to_slot_.push_back(index);
+            return {index, slots_[index].generation};
+        }
+
+        void remove(ComponentHandle handle) override
+        {
+            if (get(handle) == nullptr)
+            {
+                return;
+            }
+            uint32_t hole = slots_[handle.index].dense;
+            uint32_t last = static_cast<uint32_t>(dense_.size() - 1);
+            dense_[hole] = dense_[last];
+            owners_[hole] = owners_[last];
+            dense_to_slot_[hole] = dense_to_slot_[last];
+            slots_[dense_to_slot_[hole]].dense = hole;
+            dense_.pop_back();
+            owners_.pop_back();
+            dense_to_slot_.pop_back();
+
+            slots_[handle.index].dense = UINT32_MAX;
+            ++slots_[handle.index].generation;
+            free_slots_.push_back(handle.index);
+        }
+
+        // nullptr for a removed component
+        T *get(ComponentHandle handle) const
+        {
+            if (handle.index >= slots_.size() || slots_[handle.index].generation != handle.generation || slots_[handle.index].dense == UINT32_MAX)
+            {
+                return nullptr;
+            }
+            return dense_[slots_[handle.index].dense];
+        }
+
+        size_t size() const override
+        {
+            return dense_.size();
+        }
+
+        const std::vector<T *> &components() const
+        {
+            return dense_;
+        }
+
+        // Entity of components()[i]
+        const std::vector<Entity *> &owners() const
+        {
+            return owners_;
+        }
+    };
+}
+
+#endif // ERER_CORE_COMPONENT_POOL_H_
@@ -7,6 +7,7 @@
 #include <initializer_list> //std::initializer_list
 #include <type_traits>      // std::enable_if_v std::is_class_t
 #include <cmath>
+#include <cstdint>          // uint8_t
 
 namespace Core
 {
@@ -425,6 +426,27 @@ namespace Core
         return ret;
     }
 
+    /* Packed 8-bit color, a single 32-bit word per texel with r,g,b,a in memory order */
+    struct RGBA8
+    {
+        uint8_t rgba[4] = {0, 0, 0, 0};
+
+        RGBA8() = default;
+        RGBA8(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) : rgba{r, g, b, a} {}
+
+        inline uint8_t &operator[](int i)
+        {
+            assert(i >= 0 && i < 4);
+            return rgba[i];
+        }
+        inline uint8_t operator[](int i) const
+        {
+            assert(i >= 0 && i < 4);
+            return rgba[i];
+        }
+    };
+    static_assert(sizeof(RGBA8) == 4, "RGBA8 must stay packed");
+
     /* Alias template declaration */
     using Vector2f = Tensor<float, 2>;
     using Vector3f = Tensor<float, 3>;
@@ -4,22 +4,54 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <typeinfo>
 #include <type_traits>
 
 #include "component.h"
+#include "component_pool.h"
 
 namespace Core
 {
+    class Scene;
+    class Entity;
+    template <typename T>
+    void attach_component(Scene *scene, Entity *entity, size_t i); // defined in scene.h
+
     class Entity
     {
     private:
+        // Where components_[i] lives in the scene's pool of its type
+        struct PoolEntry
+        {
+            void (*attach)(Scene *, Entity *, size_t) = nullptr; // registers it under the type it was added as
+            ComponentPoolBase *pool = nullptr;
+            ComponentHandle handle;
+        };
+
         std::string eid_;
+        NameId name_ = Names::intern("");
+        EntityId uid_ = INVALID_ENTITY;
+        Scene *scene_ = nullptr;
         std::vector<Component *> components_;
+        std::vector<PoolEntry> pool_entries_; // parallel to components_
+        Component *slots_[MAX_COMPONENT_TYPES] = {}; // first component of each type, by component_type_id
+
+        template <typename T>
+        void fill_slot(Component *component)
+        {
+            Component *&slot = slots_[component_type_id<T>()];
+            if (slot == nullptr)
+            {
+                slot = component;
+            }
+        }
+
+        friend class Scene;
+        template <typename T>
+        friend void attach_component(Scene *scene, Entity *entity, size_t i);
 
     public:
         Entity() = default;
-        Entity(const std::string &eid) : eid_(eid)
+        Entity(const std::string &eid) : eid_(eid), name_(Names::intern(eid))
         {
         }
         ~Entity()
@@ -34,6 +66,16 @@ namespace Core
         T* add_component(T *component)
         {
             components_.push_back(component);
+            pool_entries_.push_back(PoolEntry{&attach_component<T>, nullptr, ComponentHandle()});
+            fill_slot<T>(component);
+            if constexpr (std::is_base_of<MeshComponent, T>::value && !std::is_same<MeshComponent, T>::value)
+            {
+                fill_slot<MeshComponent>(component); // a derived mesh is a mesh too
+            }
+            if (scene_ != nullptr)
+            {
+                attach_component<T>(scene_, this, components_.size() - 1);
+            }
             return component;
         }
 
@@ -42,26 +84,33 @@ namespace Core
             return components_;
         }
 
+        // The first component added as T, nullptr if there is none. Lookup is by the type passed to
+        // add_component, not the dynamic type; the one base registered as well is MeshComponent, so
+        // get_component<MeshComponent>() also finds an InstancedMeshComponent.
         template <typename T>
         T *get_component()
         {
             static_assert(std::is_base_of<Component, T>::value,
                           "Template param must be component");
 
-            for (auto p : components_)
-            {
-                if (typeid(T) == typeid(*p))
-                {
-                    return dynamic_cast<T *>(p);
-                }
-            }
-            return nullptr;
+            return static_cast<T *>(slots_[component_type_id<T>()]);
         }
 
         std::string id()
         {
             return eid_;
         }
+
+        NameId name() const
+        {
+            return name_;
+        }
+
+        // Integer id given by the scene, INVALID_ENTITY while not in one
+        EntityId uid() const
+        {
+            return uid_;
+        }
     };
 }
 
@@ -2,26 +2,83 @@
 #define ERER_CORE_IMAGE_H_
 
 #include <cstdint> // for uint*_t
+#include <cmath>   // for std::floor std::round
+#include <algorithm>
+#include <cstring>     // for std::memcpy
+#include <type_traits> // for std::is_trivially_copyable_v
 #include <assert.h>
+
+#include "../settings.h"
+
+#ifdef ERER_USE_SSE2
+#include <emmintrin.h>
+#endif
 namespace Core
 {
+    // Texel storage order. Tiled and Morton keep each 4x4 block in 16 consecutive texels so that
+    // neighbouring rows of a footprint share cache lines; Morton also swizzles texels inside the block.
+    enum class ImageLayout
+    {
+        Linear = 0,
+        Tiled,
+        Morton
+    };
+    constexpr int IMAGE_LAYOUT_COUNT = 3;
+
     template <typename T>
     class Image
     {
+    public:
+        static constexpr int TILE_SHIFT = 2; // 4x4 tiles, one 64-byte cache line of 32-bit texels
+        static constexpr int TILE_SIZE = 1 << TILE_SHIFT;
+
     private:
         T *data_ = nullptr;
         int width_ = 0;
         int height_ = 0;
+        ImageLayout layout_ = ImageLayout::Linear;
+        int tiles_x_ = 0; // tiles per row, only meaningful for tiled layouts
+        int size_ = 0;    // allocated texels, tiled layouts are padded to whole tiles
+        bool owner_ = true; // false for views over memory owned elsewhere
+
+        static int part1by1(int v)
+        {
+            return (v | (v << 1)) & 0x5;
+        } // spread the low 2 bits of v to the even bits
+
+        inline int index(int x, int y) const
+        {
+            switch (layout_)
+            {
+            case ImageLayout::Tiled:
+                return (((y >> TILE_SHIFT) * tiles_x_ + (x >> TILE_SHIFT)) << (2 * TILE_SHIFT)) | ((y & (TILE_SIZE - 1)) << TILE_SHIFT) | (x & (TILE_SIZE - 1));
+            case ImageLayout::Morton:
+                return (((y >> TILE_SHIFT) * tiles_x_ + (x >> TILE_SHIFT)) << (2 * TILE_SHIFT)) | (part1by1(y & (TILE_SIZE - 1)) << 1) | part1by1(x & (TILE_SIZE - 1));
+            default:
+                return y * width_ + x;
+            }
+        }
+
+        static int storage_size(int w, int h, ImageLayout layout)
+        {
+            if (layout == ImageLayout::Linear)
+            {
+                return w * h;
+            }
+            int tx = (w + TILE_SIZE - 1) >> TILE_SHIFT;
+            int ty = (h + TILE_SIZE - 1) >> TILE_SHIFT;
+            return (tx * ty) << (2 * TILE_SHIFT);
+        }
 
     public:
         Image()
         {
         }
-        Image(int w, int h) : data_(new T[w * h]()), width_(w), height_(h)
+        Image(int w, int h) : data_(new T[w * h]()), width_(w), height_(h), size_(w * h)
         {
             assert(w > 0 && h > 0);
         }
-        Image(T *data, int w, int h) : width_(w), height_(h)
+        Image(T *data, int w, int h) : width_(w), height_(h), size_(w * h)
         {
             assert(w > 0 && h > 0);
             data_ = data;
@@ -29,19 +86,39 @@ namespace Core
         }
         ~Image()
         {
-            if (data_ != nullptr)
+            if (data_ != nullptr && owner_)
             {
                 delete[] data_;
             }
         }
 
+        // Linear image over external memory (e.g. a shared memory slot), never freed by the view
+        static Image view(T *data, int w, int h)
+        {
+            assert(data != nullptr && w > 0 && h > 0);
+            Image ret;
+            ret.data_ = data;
+            ret.width_ = w;
+            ret.height_ = h;
+            ret.size_ = w * h;
+            ret.owner_ = false;
+            return ret;
+        }
+        bool is_view() const
+        {
+            return !owner_;
+        }
+
         /* Copy semantics */
         Image(const Image &other)
         {
             width_ = other.width_;
             height_ = other.height_;
-            data_ = new T[width_ * height_]();
-            std::copy(other.data_, other.data_ + width_ * height_, data_);
+            layout_ = other.layout_;
+            tiles_x_ = other.tiles_x_;
+            size_ = other.size_;
+            data_ = new T[size_]();
+            std::copy(other.data_, other.data_ + size_, data_);
         }
         Image &operator=(const Image &other)
         {
@@ -49,28 +126,46 @@ namespace Core
             {
                 width_ = other.width_;
                 height_ = other.height_;
-                delete[] data_;
-                data_ = new T[width_ * height_];
-                std::copy(other.data_, other.data_ + width_ * height_, data_);
+                layout_ = other.layout_;
+                tiles_x_ = other.tiles_x_;
+                size_ = other.size_;
+                if (owner_)
+                {
+                    delete[] data_;
+                }
+                owner_ = true;
+                data_ = new T[size_];
+                std::copy(other.data_, other.data_ + size_, data_);
             }
             return *this;
         }
 
         /* Move semantics */
-        Image(Image &&other)
+        Image(Image &&other) noexcept
         {
             width_ = other.width_;
             height_ = other.height_;
+            layout_ = other.layout_;
+            tiles_x_ = other.tiles_x_;
+            size_ = other.size_;
+            owner_ = other.owner_;
             data_ = other.data_;   // you can directly access other's private variables here
             other.data_ = nullptr; // assign the data members of the source object to the default value, which prevents the destructor from repeatedly releasing the resource
         }
-        Image &operator=(Image &&other)
+        Image &operator=(Image &&other) noexcept
         {
             if (this != &other)
             {
                 width_ = other.width_;
                 height_ = other.height_;
-                delete[] data_; // for dynamic arrays created in the heap, you need to delete them manually
+                layout_ = other.layout_;
+                tiles_x_ = other.tiles_x_;
+                size_ = other.size_;
+                if (owner_)
+                {
+                    delete[] data_; // for dynamic arrays created in the heap, you need to delete them manually
+                }
+                owner_ = other.owner_;
                 data_ = other.data_;
                 other.data_ = nullptr;
             }
@@ -80,18 +175,72 @@ namespace Core
         void memset(const T &value)
         {
             assert(width_ > 0 && height_ > 0);
-            for (int i = width_ * height_; i--; data_[i] = value)
-                ;
+            int i = 0;
+#ifdef ERER_USE_SSE2
+            if constexpr (sizeof(T) == 4 && std::is_trivially_copyable_v<T>)
+            {
+                int bits;
+                std::memcpy(&bits, &value, 4);
+                const __m128i v = _mm_set1_epi32(bits);
+                for (; i + 16 <= size_; i += 16) // 64 bytes per iteration
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(data_ + i), v);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(data_ + i + 4), v);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(data_ + i + 8), v);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(data_ + i + 12), v);
+                }
+            }
+#endif
+            std::fill(data_ + i, data_ + size_, value);
         }
+
+        // Reorder texels into the given layout, meant to be called once after loading
+        Image &to_layout(ImageLayout layout)
+        {
+            if (layout == layout_ || data_ == nullptr)
+            {
+                layout_ = layout;
+                return *this;
+            }
+            Image ret;
+            ret.width_ = width_;
+            ret.height_ = height_;
+            ret.layout_ = layout;
+            ret.tiles_x_ = (width_ + TILE_SIZE - 1) >> TILE_SHIFT;
+            ret.size_ = storage_size(width_, height_, layout);
+            ret.data_ = new T[ret.size_]();
+            for (int y = 0; y < height_; ++y)
+            {
+                for (int x = 0; x < width_; ++x)
+                {
+                    ret.data_[ret.index(x, y)] = data_[index(x, y)];
+                }
+            }
+            *this = std::move(ret);
+            return *this;
+        }
+        ImageLayout get_layout() const
+        {
+            return layout_;
+        }
+
         T get(int x, int y) const
         {
             // assert(data_ != nullptr && x >= 0 && y >= 0 && x < width_ && y < height_);
-            return data_[y * width_ + x];
+            return data_[index(x, y)];
         }
         void set(int x, int y, const T &value)
         {
             // assert(data_ != nullptr && x >= 0 && y >= 0 && x < width_ && y < height_);
-            data_[y * width_ + x] = value;
+            data_[index(x, y)] = value;
+        }
+        T *data()
+        {
+            return data_;
+        }
+        const T *data() const
+        {
+            return data_;
         }
         int get_width() const
         {
@@ -108,11 +257,11 @@ namespace Core
             float clip_v = v > 1 ? v - std::floor(v) : (v < 0 ? -(std::floor(v) - v) : v);
             int x = static_cast<int>(std::round(clip_u * (width_ - 1)));
             int y = static_cast<int>(std::round(clip_v * (height_ - 1)));
-            return data_[y * width_ + x];
+            return data_[index(x, y)];
         }
         T sampling(int x, int y) const
         {
-            return data_[y * width_ + x];
+            return data_[index(x, y)];
         }
     };
 }
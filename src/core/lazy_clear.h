@@ -0,0 +1,132 @@
+#ifndef ERER_CORE_LAZY_CLEAR_H_
+#define ERER_CORE_LAZY_CLEAR_H_
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+
+#include "image.h"
+
+namespace Core
+{
+    // Per-tile clear state of a linear render target. clear() only bumps a generation; a stale tile
+    // reads as the clear value and is filled the first time it is written. resolve() fills what is
+    // left before the image itself is read (readback, shadow sampling).
+    template <typename T>
+    class LazyClear
+    {
+    public:
+        static constexpr int TILE_SHIFT = 3; // 8x8 pixels
+        static constexpr int TILE_SIZE = 1 << TILE_SHIFT;
+
+    private:
+        std::vector<uint32_t> tile_gen_; // a tile is live when its generation matches gen_
+        uint32_t gen_ = 0;
+        int tiles_x_ = 0;
+        int live_tiles_ = 0;
+        bool resolved_ = true;
+        T value_{};
+
+        int tile_index(int x, int y) const
+        {
+            return (y >> TILE_SHIFT) * tiles_x_ + (x >> TILE_SHIFT);
+        }
+
+        void materialize(Image<T> &img, int tile)
+        {
+            int x0 = (tile % tiles_x_) << TILE_SHIFT;
+            int y0 = (tile / tiles_x_) << TILE_SHIFT;
+            int x1 = std::min(x0 + TILE_SIZE, img.get_width());
+            int y1 = std::min(y0 + TILE_SIZE, img.get_height());
+            T *data = img.data();
+            for (int y = y0; y < y1; ++y)
+            {
+                std::fill(data + y * img.get_width() + x0, data + y * img.get_width() + x1, value_);
+            }
+            tile_gen_[tile] = gen_;
+            ++live_tiles_;
+        }
+
+    public:
+        LazyClear()
+        {
+        }
+        LazyClear(int w, int h)
+        {
+            reset(w, h);
+        }
+
+        // Size the state to a w x h image, every tile starts live
+        void reset(int w, int h)
+        {
+            tiles_x_ = (w + TILE_SIZE - 1) >> TILE_SHIFT;
+            int tiles_y = (h + TILE_SIZE - 1) >> TILE_SHIFT;
+            tile_gen_.assign(tiles_x_ * tiles_y, 0);
+            gen_ = 0;
+            live_tiles_ = static_cast<int>(tile_gen_.size());
+            resolved_ = true;
+        }
+
+        void clear(const T &value)
+        {
+            value_ = value;
+            if (++gen_ == 0) // wrapped, old generations could match again
+            {
+                std::fill(tile_gen_.begin(), tile_gen_.end(), 0);
+                gen_ = 1;
+            }
+            live_tiles_ = 0;
+            resolved_ = false;
+        }
+
+        T get(const Image<T> &img, int x, int y) const
+        {
+            return tile_gen_[tile_index(x, y)] == gen_ ? img.get(x, y) : value_;
+        }
+
+        void set(Image<T> &img, int x, int y, const T &value)
+        {
+            int tile = tile_index(x, y);
+            if (tile_gen_[tile] != gen_)
+            {
+                materialize(img, tile);
+            }
+            img.set(x, y, value);
+        }
+
+        // Fill every stale tile, the whole image in one bulk clear if nothing was written
+        void resolve(Image<T> &img)
+        {
+            if (resolved_)
+            {
+                return;
+            }
+            assert(img.get_layout() == ImageLayout::Linear);
+            if (live_tiles_ == 0)
+            {
+                img.memset(value_);
+                std::fill(tile_gen_.begin(), tile_gen_.end(), gen_);
+                live_tiles_ = static_cast<int>(tile_gen_.size());
+            }
+            else
+            {
+                for (int tile = 0; tile < static_cast<int>(tile_gen_.size()); ++tile)
+                {
+                    if (tile_gen_[tile] != gen_)
+                    {
+                        materialize(img, tile);
+                    }
+                }
+            }
+            resolved_ = true;
+        }
+
+        bool is_resolved() const
+        {
+            return resolved_;
+        }
+    };
+}
+
+#endif // ERER_CORE_LAZY_CLEAR_H_
@@ -0,0 +1,402 @@
+#ifndef ERER_CORE_MESH_H_
+#define ERER_CORE_MESH_H_
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+#include <float.h>    // for FLT_MAX
+#include <cstring>    // for memcmp
+#include <filesystem> // for std::filesystem::file_size last_write_time
+
+#include "data_structure.hpp"
+#include "bounds.h"
+#include "simplify.h"
+#include "shader.h"
+#include "../utils/loader.h"
+#include "../utils/mapped_file.h"
+
+namespace Core
+{
+    // Levels of detail per mesh, LOD 0 is the full mesh and each next one has about half the triangles
+    constexpr size_t MAX_MESH_LODS = 4;
+    constexpr size_t LOD_MIN_TRIANGLES = 256; // smaller meshes get no LODs
+
+    // Header of the binary mesh cache (*.obj.ermesh). The streams follow at 16-byte aligned offsets:
+    // positions (xyz float), normals (xyz float), uvs (uv float), indices (uint32). Little endian only.
+    // The index stream holds the index buffers of all LODs back to back.
+    struct MeshFileHeader
+    {
+        char magic[4];          // "ERMS"
+        uint32_t version;       // MESH_FILE_VERSION
+        uint64_t source_size;   // size of the obj the cache was built from
+        int64_t source_mtime;   // last write time of that obj
+        uint32_t vertex_count;
+        uint32_t index_count;   // of all LODs
+        uint32_t lod_count;
+        uint32_t lod_index_count[MAX_MESH_LODS];
+        float bounds_min[3];
+        float bounds_max[3];
+        float bounds_radius;    // of the sphere around the box center
+        uint64_t positions_offset;
+        uint64_t normals_offset;
+        uint64_t uvs_offset;
+        uint64_t indices_offset;
+        uint64_t file_size;
+    };
+    const uint32_t MESH_FILE_VERSION = 3;
+
+    // Immutable, indexed vertex data of a loaded mesh, shared by every MeshComponent that uses it.
+    // The streams are either owned vectors or views into a memory-mapped mesh cache.
+    class MeshData
+    {
+    private:
+        std::vector<float> positions_; // xyz per vertex
+        std::vector<float> normals_;   // xyz per vertex
+        std::vector<float> uvs_;       // uv per vertex
+        std::vector<uint32_t> indices_; // three per triangle, LOD after LOD
+        Utils::MappedFile mapping_;
+
+        const float *positions_p_ = nullptr;
+        const float *normals_p_ = nullptr;
+        const float *uvs_p_ = nullptr;
+        const uint32_t *indices_p_ = nullptr;
+        size_t vertex_count_ = 0;
+        size_t index_count_ = 0; // of all LODs
+        size_t lod_count_ = 1;
+        size_t lod_first_[MAX_MESH_LODS] = {}; // first index of each LOD
+        size_t lod_index_count_[MAX_MESH_LODS] = {};
+        float bounds_min_[3] = {0, 0, 0};
+        float bounds_max_[3] = {0, 0, 0};
+        float bounds_radius_ = 0;
+
+        static uint64_t align16(uint64_t offset)
+        {
+            return (offset + 15) & ~uint64_t(15);
+        }
+
+        static bool source_stamp(const std::string &filename, uint64_t *size_p, int64_t *mtime_p)
+        {
+            std::error_code ec;
+            *size_p = std::filesystem::file_size(filename, ec);
+            if (ec)
+            {
+                return false;
+            }
+            *mtime_p = static_cast<int64_t>(std::filesystem::last_write_time(filename, ec).time_since_epoch().count());
+            return !ec;
+        }
+
+        bool map_cache(const std::string &cache_name, uint64_t source_size, int64_t source_mtime)
+        {
+            Utils::MappedFile file(cache_name);
+            if (!file.is_open() || file.size() < sizeof(MeshFileHeader))
+            {
+                return false;
+            }
+            const MeshFileHeader *h = reinterpret_cast<const MeshFileHeader *>(file.data());
+            // A stream fits when it starts aligned inside the file and ends before its end
+            auto fits = [&file](uint64_t offset, uint64_t count, uint64_t stride)
+            {
+                return offset % 4 == 0 && offset <= file.size() && count * stride <= file.size() - offset;
+            };
+            if (memcmp(h->magic, "ERMS", 4) != 0 || h->version != MESH_FILE_VERSION || h->file_size != file.size() ||
+                h->source_size != source_size || h->source_mtime != source_mtime || h->lod_count == 0 || h->lod_count > MAX_MESH_LODS ||
+                !fits(h->positions_offset, h->vertex_count, 3 * sizeof(float)) || !fits(h->normals_offset, h->vertex_count, 3 * sizeof(float)) ||
+                !fits(h->uvs_offset, h->vertex_count, 2 * sizeof(float)) || !fits(h->indices_offset, h->index_count, sizeof(uint32_t)))
+            {
+                return false; // stale or damaged, parse the obj instead
+            }
+            uint64_t total = 0;
+            for (size_t i = 0; i < h->lod_count; ++i)
+            {
+                if (h->lod_index_count[i] % 3 != 0)
+                {
+                    return false;
+                }
+                total += h->lod_index_count[i];
+            }
+            if (total != h->index_count)
+            {
+                return false;
+            }
+            // One pass over the indices, every consumer indexes vertex arrays with them unchecked
+            const uint32_t *indices = reinterpret_cast<const uint32_t *>(file.data() + h->indices_offset);
+            uint32_t max_index = 0;
+            for (size_t i = 0; i < h->index_count; ++i)
+            {
+                max_index = std::max(max_index, indices[i]);
+            }
+            if (h->index_count > 0 && max_index >= h->vertex_count)
+            {
+                return false;
+            }
+            size_t first = 0;
+            for (size_t i = 0; i < h->lod_count; ++i)
+            {
+                lod_first_[i] = first;
+                lod_index_count_[i] = h->lod_index_count[i];
+                first += h->lod_index_count[i];
+            }
+            lod_count_ = h->lod_count;
+            positions_p_ = reinterpret_cast<const float *>(file.data() + h->positions_offset);
+            normals_p_ = reinterpret_cast<const float *>(file.data() + h->normals_offset);
+            uvs_p_ = reinterpret_cast<const float *>(file.data() + h->uvs_offset);
+            indices_p_ = reinterpret_cast<const uint32_t *>(file.data() + h->indices_offset);
+            vertex_count_ = h->vertex_count;
+            index_count_ = h->index_count;
+            for (int k = 0; k < 3; ++k)
+            {
+                bounds_min_[k] = h->bounds_min[k];
+                bounds_max_[k] = h->bounds_max[k];
+            }
+            bounds_radius_ = h->bounds_radius;
+            mapping_ = std::move(file);
+            return true;
+        }
+
+        // Unique per process and call, so processes or loader threads caching the same obj never
+        // write into one temp file
+        static std::string temp_suffix()
+        {
+            static std::atomic<uint64_t> counter{0};
+#ifdef _WIN32
+            unsigned long pid = GetCurrentProcessId();
+#else
+            long pid = static_cast<long>(getpid());
+#endif
+            return "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+        }
+
+        bool write_cache(const std::string &cache_name, uint64_t source_size, int64_t source_mtime) const
+        {
+            MeshFileHeader h{};
+            memcpy(h.magic, "ERMS", 4);
+            h.version = MESH_FILE_VERSION;
+            h.source_size = source_size;
+            h.source_mtime = source_mtime;
+            h.vertex_count = static_cast<uint32_t>(vertex_count_);
+            h.index_count = static_cast<uint32_t>(index_count_);
+            h.lod_count = static_cast<uint32_t>(lod_count_);
+            for (size_t i = 0; i < lod_count_; ++i)
+            {
+                h.lod_index_count[i] = static_cast<uint32_t>(lod_index_count_[i]);
+            }
+            for (int k = 0; k < 3; ++k)
+            {
+                h.bounds_min[k] = bounds_min_[k];
+                h.bounds_max[k] = bounds_max_[k];
+            }
+            h.bounds_radius = bounds_radius_;
+            h.positions_offset = align16(sizeof(MeshFileHeader));
+            h.normals_offset = align16(h.positions_offset + vertex_count_ * 3 * sizeof(float));
+            h.uvs_offset = align16(h.normals_offset + vertex_count_ * 3 * sizeof(float));
+            h.indices_offset = align16(h.uvs_offset + vertex_count_ * 2 * sizeof(float));
+            h.file_size = h.indices_offset + index_count_ * sizeof(uint32_t);
+
+            std::string tmp_name = cache_name + temp_suffix();
+            std::ofstream out(tmp_name, std::ios::binary);
+            if (!out.is_open())
+            {
+                return false;
+            }
+            auto write_at = [&out](uint64_t offset, const void *data, size_t bytes)
+            {
+                static const char zeros[16] = {};
+                uint64_t pos = static_cast<uint64_t>(out.tellp());
+                out.write(zeros, static_cast<std::streamsize>(offset - pos)); // padding
+                out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+            };
+            write_at(0, &h, sizeof(h));
+            write_at(h.positions_offset, positions_p_, vertex_count_ * 3 * sizeof(float));
+            write_at(h.normals_offset, normals_p_, vertex_count_ * 3 * sizeof(float));
+            write_at(h.uvs_offset, uvs_p_, vertex_count_ * 2 * sizeof(float));
+            write_at(h.indices_offset, indices_p_, index_count_ * sizeof(uint32_t));
+            bool ok = out.good();
+            out.close();
+            std::error_code ec;
+            if (ok)
+            {
+                std::filesystem::rename(tmp_name, cache_name, ec); // never expose a half written cache
+            }
+            if (!ok || ec)
+            {
+                std::filesystem::remove(tmp_name, ec);
+                return false;
+            }
+            return true;
+        }
+
+        void compute_bounds()
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                bounds_min_[k] = vertex_count_ ? FLT_MAX : 0.f;
+                bounds_max_[k] = vertex_count_ ? -FLT_MAX : 0.f;
+            }
+            for (size_t v = 0; v < vertex_count_; ++v)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    bounds_min_[k] = std::min(bounds_min_[k], positions_p_[3 * v + k]);
+                    bounds_max_[k] = std::max(bounds_max_[k], positions_p_[3 * v + k]);
+                }
+            }
+            // Tighter than the half diagonal for round meshes
+            float radius2 = 0;
+            for (size_t v = 0; v < vertex_count_; ++v)
+            {
+                float d2 = 0;
+                for (int k = 0; k < 3; ++k)
+                {
+                    float d = positions_p_[3 * v + k] - (bounds_min_[k] + bounds_max_[k]) / 2;
+                    d2 += d * d;
+                }
+                radius2 = std::max(radius2, d2);
+            }
+            bounds_radius_ = std::sqrt(radius2);
+        }
+
+        // Simplify into LODs with half, a quarter and an eighth of the triangles. The chain stops
+        // early when seams or borders keep a level from shrinking much.
+        void build_lods()
+        {
+            lod_count_ = 1;
+            lod_first_[0] = 0;
+            lod_index_count_[0] = index_count_;
+            size_t triangles = index_count_ / 3;
+            if (triangles < LOD_MIN_TRIANGLES)
+            {
+                return;
+            }
+            std::vector<size_t> targets;
+            for (size_t i = 1; i < MAX_MESH_LODS; ++i)
+            {
+                targets.push_back(triangles >> i);
+            }
+            std::vector<std::vector<uint32_t>> chain = simplify_lod_chain(positions_p_, normals_p_, uvs_p_, vertex_count_, indices_p_, index_count_, targets);
+            for (const auto &lod : chain)
+            {
+                if (lod.size() * 5 > lod_index_count_[lod_count_ - 1] * 4)
+                {
+                    break;
+                }
+                lod_first_[lod_count_] = indices_.size();
+                lod_index_count_[lod_count_] = lod.size();
+                indices_.insert(indices_.end(), lod.begin(), lod.end());
+                ++lod_count_;
+            }
+            indices_p_ = indices_.data();
+            index_count_ = indices_.size();
+        }
+
+    public:
+        MeshData() = default;
+        MeshData(Utils::ObjMesh &&mesh)
+            : positions_(std::move(mesh.positions)), normals_(std::move(mesh.normals)), uvs_(std::move(mesh.uvs)), indices_(std::move(mesh.indices))
+        {
+            positions_p_ = positions_.data();
+            normals_p_ = normals_.data();
+            uvs_p_ = uvs_.data();
+            indices_p_ = indices_.data();
+            vertex_count_ = positions_.size() / 3;
+            index_count_ = indices_.size();
+            compute_bounds();
+            build_lods();
+        }
+
+        /* Move only, the stream pointers stay valid because vector buffers and mappings move along */
+        MeshData(const MeshData &other) = delete;
+        MeshData &operator=(const MeshData &other) = delete;
+        MeshData(MeshData &&other) = default;
+        MeshData &operator=(MeshData &&other) = default;
+
+        // Map {filename}.ermesh if it is up to date with the obj, otherwise parse the obj and write the cache
+        static MeshData from_obj_file(const std::string &filename)
+        {
+            std::string cache_name = filename + ".ermesh";
+            uint64_t source_size = 0;
+            int64_t source_mtime = 0;
+            bool has_stamp = source_stamp(filename, &source_size, &source_mtime);
+
+            MeshData ret;
+            if (has_stamp && ret.map_cache(cache_name, source_size, source_mtime))
+            {
+                return ret;
+            }
+            Utils::ObjMesh mesh;
+            Utils::load_obj_file(filename, &mesh);
+            ret = MeshData(std::move(mesh));
+            if (has_stamp && !ret.write_cache(cache_name, source_size, source_mtime))
+            {
+                std::clog << "Can't write mesh cache [" << cache_name << "]" << std::endl;
+            }
+            return ret;
+        }
+
+        bool is_mapped() const
+        {
+            return mapping_.is_open();
+        }
+        size_t vertex_count() const
+        {
+            return vertex_count_;
+        }
+        size_t lod_count() const
+        {
+            return lod_count_;
+        }
+        size_t triangle_count(size_t lod = 0) const
+        {
+            return lod_index_count_[lod] / 3;
+        }
+        const float *positions() const
+        {
+            return positions_p_;
+        }
+        const float *normals() const
+        {
+            return normals_p_;
+        }
+        const float *uvs() const
+        {
+            return uvs_p_;
+        }
+        // Index buffer of a LOD, all LODs index the same vertices
+        const uint32_t *indices(size_t lod = 0) const
+        {
+            return indices_p_ + lod_first_[lod];
+        }
+        Vector3f get_bounds_min() const
+        {
+            return Vector3f{bounds_min_[0], bounds_min_[1], bounds_min_[2]};
+        }
+        Vector3f get_bounds_max() const
+        {
+            return Vector3f{bounds_max_[0], bounds_max_[1], bounds_max_[2]};
+        }
+        // Model space box and sphere, empty without vertices
+        Bounds get_bounds() const
+        {
+            return vertex_count_ ? Bounds::from_box(bounds_min_, bounds_max_, bounds_radius_) : Bounds();
+        }
+
+        VertexInput get_vertex(uint32_t i) const
+        {
+            const float *p = positions() + 3 * i;
+            const float *n = normals() + 3 * i;
+            const float *t = uvs() + 2 * i;
+            VertexInput ret;
+            ret.MS_POSITION = Vector4f{p[0], p[1], p[2], 1.f};
+            ret.MS_NORMAL = Vector3f{n[0], n[1], n[2]};
+            ret.UV = Vector3f{t[0], t[1], 0.f};
+            return ret;
+        }
+    };
+}
+
+#endif // ERER_CORE_MESH_H_
@@ -0,0 +1,281 @@
+#ifndef ERER_CORE_OCCLUSION_H_
+#define ERER_CORE_OCCLUSION_H_
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef> // for size_t
+
+#include "data_structure.hpp"
+#include "bounds.h"
+#include "../settings.h"
+
+#ifdef ERER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace Core
+{
+    /* Low resolution depth of a few large occluders, for skipping meshes hidden behind them.
+       Both sides are conservative so culling never removes a visible pixel: a texel only counts
+       as covered when the occluder covers all of it, and it keeps the occluder's farthest depth
+       inside the texel. A mesh is occluded when every texel under its screen box is covered by
+       something nearer than the mesh's nearest corner.
+       Depth is stored as 1 / w (w is the view depth), 0 where nothing was drawn. */
+    class OcclusionBuffer
+    {
+    public:
+        static constexpr int DEFAULT_WIDTH = 256;
+        static constexpr int DEFAULT_HEIGHT = 128;
+
+    private:
+        int width_;  // multiple of 4, four texels per SIMD step
+        int height_;
+        std::vector<float> inv_w_;
+        float vp_[4][4];
+        float near_ = 0.f;
+        std::vector<uint64_t> signature_; // occluders (and their versions) in the buffer
+        bool valid_ = false;
+
+        struct ScreenVertex
+        {
+            float x, y, inv_w;
+            bool in_front; // w >= near, otherwise the triangle is dropped
+        };
+
+        // Clip space to buffer texels, the same mapping as the camera viewport scaled down
+        ScreenVertex project(const float m[4][4], float px, float py, float pz) const
+        {
+            float c[4];
+            for (int i = 0; i < 4; ++i)
+            {
+                c[i] = m[i][0] * px + m[i][1] * py + m[i][2] * pz + m[i][3];
+            }
+            ScreenVertex ret;
+            ret.in_front = c[3] >= near_;
+            float inv_w = ret.in_front ? 1 / c[3] : 0.f;
+            ret.x = (c[0] * inv_w + 1) / 2 * width_;
+            ret.y = (c[1] * inv_w + 1) / 2 * height_;
+            ret.inv_w = inv_w;
+            return ret;
+        }
+
+        void draw_triangle(ScreenVertex a, ScreenVertex b, ScreenVertex c)
+        {
+            float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+            if (!(std::abs(area) > 1e-8f))
+            {
+                return;
+            }
+            if (area < 0)
+            {
+                std::swap(b, c); // counter clockwise, edges are positive inside
+                area = -area;
+            }
+            // Edge functions e = A x + B y + C, shifted so e >= 0 means the whole texel is inside
+            const ScreenVertex *v[3] = {&a, &b, &c};
+            float A[3], B[3], C[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                const ScreenVertex &p = *v[(i + 1) % 3];
+                const ScreenVertex &q = *v[(i + 2) % 3];
+                A[i] = p.y - q.y;
+                B[i] = q.x - p.x;
+                C[i] = p.x * q.y - p.y * q.x - (std::abs(A[i]) + std::abs(B[i])) / 2;
+            }
+            // 1/w is affine in screen space; keep its smallest value over the texel
+            float zA = (A[0] * a.inv_w + A[1] * b.inv_w + A[2] * c.inv_w) / area;
+            float zB = (B[0] * a.inv_w + B[1] * b.inv_w + B[2] * c.inv_w) / area;
+            float zC = (a.inv_w * (b.x * c.y - b.y * c.x) + b.inv_w * (c.x * a.y - c.y * a.x) + c.inv_w * (a.x * b.y - a.y * b.x)) / area;
+            zC -= (std::abs(zA) + std::abs(zB)) / 2;
+
+            int x0 = std::max(0, static_cast<int>(std::floor(std::min({a.x, b.x, c.x}))));
+            int x1 = std::min(width_ - 1, static_cast<int>(std::floor(std::max({a.x, b.x, c.x}))));
+            int y0 = std::max(0, static_cast<int>(std::floor(std::min({a.y, b.y, c.y}))));
+            int y1 = std::min(height_ - 1, static_cast<int>(std::floor(std::max({a.y, b.y, c.y}))));
+            if (x0 > x1 || y0 > y1)
+            {
+                return;
+            }
+            x0 &= ~3;
+            for (int y = y0; y <= y1; ++y)
+            {
+                float cy = y + 0.5f;
+                float *row = inv_w_.data() + static_cast<size_t>(y) * width_;
+                int x = x0;
+#ifdef ERER_USE_SSE2
+                const __m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                const __m128 zero = _mm_setzero_ps();
+                for (; x <= x1; x += 4)
+                {
+                    __m128 cx = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), step);
+                    __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[0]), cx), _mm_set1_ps(B[0] * cy + C[0])), zero);
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[1]), cx), _mm_set1_ps(B[1] * cy + C[1])), zero));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[2]), cx), _mm_set1_ps(B[2] * cy + C[2])), zero));
+                    if (_mm_movemask_ps(inside) == 0)
+                    {
+                        continue;
+                    }
+                    __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), cx), _mm_set1_ps(zB * cy + zC));
+                    __m128 old = _mm_loadu_ps(row + x);
+                    __m128 nearer = _mm_max_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+                }
+#endif
+                for (; x <= x1; ++x)
+                {
+                    float cx = x + 0.5f;
+                    if (A[0] * cx + B[0] * cy + C[0] >= 0 && A[1] * cx + B[1] * cy + C[1] >= 0 && A[2] * cx + B[2] * cy + C[2] >= 0)
+                    {
+                        row[x] = std::max(row[x], zA * cx + zB * cy + zC);
+                    }
+                }
+            }
+        }
+
+    public:
+        OcclusionBuffer(int width = DEFAULT_WIDTH, int height = DEFAULT_HEIGHT)
+            : width_((std::max(width, 4) + 3) & ~3), height_(std::max(height, 1)), inv_w_(static_cast<size_t>(width_) * height_, 0.f)
+        {
+        }
+
+        // True when the buffer already holds these occluders seen through VP, e.g. from the last
+        // frame of a static camera or from another camera at the same viewpoint
+        bool matches(const Matrix4f &VP, float near, const std::vector<uint64_t> &signature) const
+        {
+            if (!valid_ || near != near_ || signature != signature_)
+            {
+                return false;
+            }
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    if (VP[i][j] != vp_[i][j])
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Clear for a new set of occluders, near is the camera's near plane
+        void begin(const Matrix4f &VP, float near, std::vector<uint64_t> signature)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    vp_[i][j] = VP[i][j];
+                }
+            }
+            near_ = near;
+            signature_ = std::move(signature);
+            std::fill(inv_w_.begin(), inv_w_.end(), 0.f);
+            valid_ = true;
+        }
+
+        // Triangles crossing the near plane are skipped, the renderer clips them
+        void rasterize(const float *positions, size_t vertex_count, const uint32_t *indices, size_t triangle_count, const Matrix4f &M)
+        {
+            float m[4][4];
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    m[i][j] = vp_[i][0] * M[0][j] + vp_[i][1] * M[1][j] + vp_[i][2] * M[2][j] + vp_[i][3] * M[3][j];
+                }
+            }
+            std::vector<ScreenVertex> screen(vertex_count);
+            for (size_t i = 0; i < vertex_count; ++i)
+            {
+                screen[i] = project(m, positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+            }
+            for (size_t f = 0; f < triangle_count; ++f)
+            {
+                const ScreenVertex &a = screen[indices[3 * f]];
+                const ScreenVertex &b = screen[indices[3 * f + 1]];
+                const ScreenVertex &c = screen[indices[3 * f + 2]];
+                if (a.in_front && b.in_front && c.in_front)
+                {
+                    draw_triangle(a, b, c);
+                }
+            }
+        }
+
+        bool occluded(const Bounds &world_bounds) const
+        {
+            if (!valid_ || world_bounds.empty())
+            {
+                return false;
+            }
+            float x_lo = FLT_MAX, y_lo = FLT_MAX, x_hi = -FLT_MAX, y_hi = -FLT_MAX, nearest = 0.f;
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                ScreenVertex v = project(vp_, corner & 1 ? world_bounds.max[0] : world_bounds.min[0],
+                                         corner & 2 ? world_bounds.max[1] : world_bounds.min[1],
+                                         corner & 4 ? world_bounds.max[2] : world_bounds.min[2]);
+                if (!v.in_front)
+                {
+                    return false; // reaches the camera
+                }
+                x_lo = std::min(x_lo, v.x);
+                x_hi = std::max(x_hi, v.x);
+                y_lo = std::min(y_lo, v.y);
+                y_hi = std::max(y_hi, v.y);
+                nearest = std::max(nearest, v.inv_w);
+            }
+            int x0 = std::max(0, static_cast<int>(std::floor(x_lo)));
+            int x1 = std::min(width_ - 1, static_cast<int>(std::floor(x_hi)));
+            int y0 = std::max(0, static_cast<int>(std::floor(y_lo)));
+            int y1 = std::min(height_ - 1, static_cast<int>(std::floor(y_hi)));
+            if (x0 > x1 || y0 > y1)
+            {
+                return false; // off screen, left to frustum culling
+            }
+            for (int y = y0; y <= y1; ++y)
+            {
+                const float *row = inv_w_.data() + static_cast<size_t>(y) * width_;
+                int x = x0;
+#ifdef ERER_USE_SSE2
+                const __m128 mesh = _mm_set1_ps(nearest);
+                for (; x + 4 <= x1 + 1; x += 4)
+                {
+                    if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), mesh)) != 0)
+                    {
+                        return false;
+                    }
+                }
+#endif
+                for (; x <= x1; ++x)
+                {
+                    if (row[x] <= nearest)
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        int get_width() const
+        {
+            return width_;
+        }
+
+        int get_height() const
+        {
+            return height_;
+        }
+
+        // 1 / view depth of texel (x, y), 0 where no occluder covers it
+        float get_inv_depth(int x, int y) const
+        {
+            return inv_w_[static_cast<size_t>(y) * width_ + x];
+        }
+    };
+}
+
+#endif // ERER_CORE_OCCLUSION_H_
@@ -0,0 +1,165 @@
+#ifndef ERER_CORE_RENDER_QUEUE_H_
+#define ERER_CORE_RENDER_QUEUE_H_
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef> // for size_t
+
+namespace Core
+{
+    /* 64 bit draw order, most significant bits first:
+           pass (4) | layer (1) | material (16) | depth (24) | unused (19)
+       so a camera draws its passes in order, opaque before transparent, grouped by material and
+       front to back inside a group. Transparent draws blend order independently, their depth only
+       keeps the order stable. */
+    struct SortKey
+    {
+        enum Pass
+        {
+            ShadowPass = 0,
+            ColorPass
+        };
+        enum Layer
+        {
+            OpaqueLayer = 0,
+            TransparentLayer
+        };
+
+        static constexpr int PASS_SHIFT = 60;
+        static constexpr int LAYER_SHIFT = 59;
+        static constexpr int DEPTH_BITS = 24;
+        static constexpr int MATERIAL_BITS = 16;
+        static constexpr int LOW_SHIFT = 19; // of the last field
+
+        // depth01 is the view depth mapped to [0, 1] over the camera's near and far planes
+        static uint64_t make(Pass pass, Layer layer, uint64_t material, float depth01)
+        {
+            uint64_t depth = quantize_depth(depth01);
+            uint64_t m = material_bits(material);
+            return static_cast<uint64_t>(pass) << PASS_SHIFT | static_cast<uint64_t>(layer) << LAYER_SHIFT | m << (LOW_SHIFT + DEPTH_BITS) | depth << LOW_SHIFT;
+        }
+
+        static uint64_t quantize_depth(float depth01)
+        {
+            float d = std::clamp(depth01, 0.f, 1.f); // also sends NaN to 0
+            return static_cast<uint64_t>(d * static_cast<float>((1u << DEPTH_BITS) - 1));
+        }
+
+        // Any 64 bit material identity folded to MATERIAL_BITS; a collision only merges two groups
+        static uint64_t material_bits(uint64_t material)
+        {
+            return (material * 0x9E3779B97F4A7C15ull) >> (64 - MATERIAL_BITS);
+        }
+
+        static Pass pass(uint64_t key)
+        {
+            return static_cast<Pass>(key >> PASS_SHIFT);
+        }
+
+        static Layer layer(uint64_t key)
+        {
+            return static_cast<Layer>(key >> LAYER_SHIFT & 1);
+        }
+    };
+
+    /* Draw commands of one camera. Traversal records them into per-thread lists, each thread only
+       touching its own, then sort() merges the lists and orders them by key with an LSD radix sort,
+       which is stable, so draws with equal keys keep their recording order. */
+    template <typename T>
+    class RenderQueue
+    {
+    public:
+        struct Command
+        {
+            uint64_t key;
+            T item;
+        };
+
+    private:
+        std::vector<std::vector<Command>> lists_; // one per recording thread
+        std::vector<Command> commands_;           // merged and sorted
+        std::vector<Command> scratch_;
+
+        // 8 passes of 8 bits, skipping the bytes every key shares
+        void radix_sort()
+        {
+            size_t n = commands_.size();
+            if (n < 2)
+            {
+                return;
+            }
+            size_t counts[8][256] = {};
+            for (const Command &command : commands_)
+            {
+                for (int digit = 0; digit < 8; ++digit)
+                {
+                    ++counts[digit][command.key >> (8 * digit) & 0xff];
+                }
+            }
+            scratch_.resize(n);
+            for (int digit = 0; digit < 8; ++digit)
+            {
+                size_t *count = counts[digit];
+                if (count[commands_[0].key >> (8 * digit) & 0xff] == n)
+                {
+                    continue;
+                }
+                size_t offset = 0;
+                for (int b = 0; b < 256; ++b)
+                {
+                    size_t c = count[b];
+                    count[b] = offset;
+                    offset += c;
+                }
+                for (const Command &command : commands_)
+                {
+                    scratch_[count[command.key >> (8 * digit) & 0xff]++] = command;
+                }
+                commands_.swap(scratch_);
+            }
+        }
+
+    public:
+        // Start a new frame with the given number of recording threads
+        void begin(size_t recorders = 1)
+        {
+            lists_.resize(std::max<size_t>(recorders, 1));
+            for (auto &list : lists_)
+            {
+                list.clear();
+            }
+            commands_.clear();
+        }
+
+        // List of recording thread i, safe to fill concurrently with the other lists
+        std::vector<Command> &recorder(size_t i)
+        {
+            return lists_[i];
+        }
+
+        // Merge the recorded lists in thread order and sort by key
+        const std::vector<Command> &sort()
+        {
+            size_t total = 0;
+            for (const auto &list : lists_)
+            {
+                total += list.size();
+            }
+            commands_.reserve(total);
+            for (const auto &list : lists_)
+            {
+                commands_.insert(commands_.end(), list.begin(), list.end());
+            }
+            radix_sort();
+            return commands_;
+        }
+
+        const std::vector<Command> &commands() const
+        {
+            return commands_;
+        }
+    };
+}
+
+#endif // ERER_CORE_RENDER_QUEUE_H_
@@ -0,0 +1,101 @@
+#ifndef ERER_CORE_RESOLUTION_H_
+#define ERER_CORE_RESOLUTION_H_
+#include <cmath>
+#include <algorithm>
+
+#include "component.h"
+#include "stats.h"
+
+namespace Core
+{
+    // Scales a color camera's render resolution so frames fit a time budget. The front end keeps
+    // showing the image at the output (window) size and upscales whatever the camera rendered.
+    class ResolutionController
+    {
+    private:
+        CameraComponent *camera_;
+        double budget_ms_;
+        float min_scale_;
+        float max_scale_;
+        float scale_ = 1.f;
+        int output_width_;
+        int output_height_;
+        double avg_ms_ = -1.; // smoothed frame time, -1 before the first frame
+
+    public:
+        ResolutionController(CameraComponent *camera, double budget_ms = 33., float min_scale = 0.25f, float max_scale = 1.f)
+            : camera_(camera), budget_ms_(budget_ms), min_scale_(min_scale), max_scale_(max_scale), output_width_(camera->get_width()), output_height_(camera->get_height())
+        {
+            Stats::record("budget_ms", budget_ms_);
+        }
+
+        ResolutionController *set_output_size(int w, int h)
+        {
+            output_width_ = w;
+            output_height_ = h;
+            return this;
+        }
+
+        ResolutionController *set_budget(double budget_ms)
+        {
+            budget_ms_ = budget_ms;
+            Stats::record("budget_ms", budget_ms_);
+            return this;
+        }
+
+        /* Feed the render time of the last frame. Going over budget reacts at once, coming back
+           under it only moves once the smoothed time leaves the 80%-100% band, so the scale does not
+           oscillate. Returns true when the camera should be resized with apply(). */
+        bool frame_done(double frame_ms)
+        {
+            if (avg_ms_ < 0 || frame_ms > budget_ms_ * 1.2)
+            {
+                avg_ms_ = frame_ms; // a heavy mesh came into view, don't wait for the average
+            }
+            else
+            {
+                avg_ms_ = 0.7 * avg_ms_ + 0.3 * frame_ms;
+            }
+            if (avg_ms_ > budget_ms_ || avg_ms_ < 0.8 * budget_ms_)
+            {
+                // Cost follows the pixel count, i.e. scale^2; aim a bit under budget and limit each step
+                float step = static_cast<float>(std::sqrt(0.9 * budget_ms_ / std::max(avg_ms_, 1e-3)));
+                scale_ = std::clamp(scale_ * std::clamp(step, 0.5f, 1.2f), min_scale_, max_scale_);
+            }
+            Stats::record("frame_ms", frame_ms);
+            Stats::record("frame_ms_avg", avg_ms_);
+            Stats::record("render_scale", scale_);
+            Stats::record("render_width", get_render_width());
+            Stats::record("render_height", get_render_height());
+            return needs_resize();
+        }
+
+        int get_render_width() const
+        {
+            return std::max(1, static_cast<int>(std::lround(output_width_ * scale_)));
+        }
+
+        int get_render_height() const
+        {
+            return std::max(1, static_cast<int>(std::lround(output_height_ * scale_)));
+        }
+
+        float get_scale() const
+        {
+            return scale_;
+        }
+
+        bool needs_resize() const
+        {
+            return camera_->get_width() != get_render_width() || camera_->get_height() != get_render_height();
+        }
+
+        // Resize the camera to the current scale, not while a frame renders
+        void apply()
+        {
+            camera_->resize(get_render_width(), get_render_height());
+        }
+    };
+}
+
+#endif // ERER_CORE_RESOLUTION_H_
@@ -4,10 +4,16 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <string>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
 
 #include "entity.h"
 #include "component.h"
+#include "component_pool.h"
+#include "bvh.h"
 #include "../utils/convert.h"
 #include "../utils/tgaimage.h"
 
@@ -20,7 +26,53 @@ namespace Core
     {
     private:
         std::string sid_;
-        std::map<std::string, Entity *> entities_;
+        EntityId next_uid_ = INVALID_ENTITY + 1;
+        std::unordered_map<EntityId, Entity *> entities_;
+        std::unordered_map<NameId, EntityId> names_;
+        std::unique_ptr<ComponentPoolBase> pools_[MAX_COMPONENT_TYPES]; // by component_type_id
+        std::vector<Component *> transform_order_; // parents before children
+        bool transform_order_stale_ = true;
+        uint64_t transform_order_version_ = 0; // Component::get_hierarchy_version() it was built at
+        Bvh<MeshComponent *> mesh_bvh_;         // world bounds of the loaded meshes
+        std::vector<MeshComponent *> meshes_;   // added as MeshComponent or InstancedMeshComponent
+        std::vector<MeshComponent *> index_dirty_; // meshes touched since the last update_spatial_index
+        std::vector<MeshComponent *> index_work_;  // index_dirty_ refitted by the last update_spatial_index
+        uint64_t mesh_generation_ = 0;             // bumped by every mesh added or removed
+
+        void add_mesh(MeshComponent *mesh)
+        {
+            mesh->scene_slot_ = static_cast<int>(meshes_.size());
+            meshes_.push_back(mesh);
+            ++mesh_generation_;
+            mesh->index_queue_ = &index_dirty_;
+            mesh->queue_index();
+        }
+
+        void remove_mesh(MeshComponent *mesh)
+        {
+            meshes_.back()->scene_slot_ = mesh->scene_slot_; // move the last one into the hole, like ComponentPool::remove
+            meshes_[mesh->scene_slot_] = meshes_.back();
+            meshes_.pop_back();
+            mesh->scene_slot_ = -1;
+            ++mesh_generation_;
+            index_work_.clear(); // already planned, and the generation change repaints everything
+            if (mesh->index_slot_ >= 0)
+            {
+                index_dirty_.back()->index_slot_ = mesh->index_slot_;
+                index_dirty_[mesh->index_slot_] = index_dirty_.back();
+                index_dirty_.pop_back();
+            }
+            mesh->index_queue_ = nullptr;
+            mesh->index_slot_ = -1;
+            if (mesh->bvh_proxy_ >= 0)
+            {
+                mesh_bvh_.remove(mesh->bvh_proxy_);
+                mesh->bvh_proxy_ = -1;
+            }
+        }
+
+        template <typename T>
+        friend void attach_component(Scene *scene, Entity *entity, size_t i);
 
     public:
         Scene(const std::string &sid)
@@ -31,44 +83,108 @@ namespace Core
         {
             sid_.clear();
             sid_.shrink_to_fit(); // unique method of string and vector after c++ 11
-            entities_.clear();    // it will call destructor of each item in map
+            for (auto iter = entities_.begin(); iter != entities_.end(); iter++)
+            {
+                iter->second->scene_ = nullptr; // the pools go away with the scene
+            }
+            for (auto mesh : meshes_)
+            {
+                mesh->bvh_proxy_ = -1; // so does the BVH
+                mesh->index_queue_ = nullptr;
+                mesh->index_slot_ = -1;
+                mesh->scene_slot_ = -1;
+            }
+            entities_.clear();
         }
 
         Entity *add_entity(Entity *entity)
         {
-            if (entities_.find(entity->id()) != entities_.end())
+            if (names_.find(entity->name()) != names_.end() || entity->scene_ != nullptr)
             {
                 std::clog << "[" << entity->id() + "] is existed" << std::endl;
                 return entity;
             }
-            entities_[entity->id()] = entity;
+            entity->uid_ = next_uid_++;
+            entity->scene_ = this;
+            entities_[entity->uid_] = entity;
+            names_[entity->name()] = entity->uid_;
+            transform_order_stale_ = true;
+            for (size_t i = 0; i < entity->pool_entries_.size(); ++i)
+            {
+                entity->pool_entries_[i].attach(this, entity, i); // components added before the entity joined
+            }
             return entity;
-            // entities_.insert(std::pair<std::string, Entity *>(entity->id(), entity));
+        }
+
+        // Takes the entity and its components out of the scene, the entity itself is not deleted
+        void delete_entity(EntityId uid)
+        {
+            auto iter = entities_.find(uid);
+            if (iter == entities_.end())
+            {
+                std::clog << "[" << uid << "] is not exist" << std::endl;
+                return;
+            }
+            Entity *entity = iter->second;
+            const ComponentPoolBase *mesh_pool = pools_[component_type_id<MeshComponent>()].get();
+            const ComponentPoolBase *instanced_pool = pools_[component_type_id<InstancedMeshComponent>()].get();
+            for (size_t i = 0; i < entity->pool_entries_.size(); ++i)
+            {
+                Entity::PoolEntry &entry = entity->pool_entries_[i];
+                if (entry.pool == mesh_pool || entry.pool == instanced_pool)
+                {
+                    remove_mesh(static_cast<MeshComponent *>(entity->components_[i]));
+                }
+                entry.pool->remove(entry.handle);
+                entry.pool = nullptr;
+                entry.handle = ComponentHandle();
+            }
+            names_.erase(entity->name());
+            entities_.erase(iter);
+            transform_order_stale_ = true;
+            entity->scene_ = nullptr;
+            entity->uid_ = INVALID_ENTITY;
         }
 
         void delete_entity(const std::string &eid)
         {
-            if (!entities_.erase(eid))
+            auto iter = names_.find(Names::intern(eid));
+            if (iter == names_.end())
             {
                 std::clog << "[" << eid + "] is not exist" << std::endl;
+                return;
             }
+            delete_entity(iter->second);
         }
 
-        Entity *get_entity(const std::string eid)
+        Entity *get_entity(EntityId uid)
         {
-            auto iter = entities_.find(eid);
+            auto iter = entities_.find(uid);
+            return iter != entities_.end() ? iter->second : nullptr;
+        }
 
-            if (iter != entities_.end())
+        // NameId and EntityId are both integers, hence the different name
+        Entity *get_entity_by_name(NameId name)
+        {
+            auto iter = names_.find(name);
+
+            if (iter != names_.end())
             {
-                return iter->second;
+                return entities_[iter->second];
             }
-            std::clog << "Can't find entity [" << eid << "]" << std::endl;
+            std::clog << "Can't find entity [" << Names::str(name) << "]" << std::endl;
             return nullptr;
         }
 
+        Entity *get_entity(const std::string &eid)
+        {
+            return get_entity_by_name(Names::intern(eid));
+        }
+
         std::vector<Entity *> get_all_entities()
         {
             std::vector<Entity *> ret;
+            ret.reserve(entities_.size());
             for (auto iter = entities_.begin(); iter != entities_.end(); iter++)
             {
                 ret.push_back(iter->second);
@@ -76,21 +192,160 @@ namespace Core
             return ret;
         }
 
+        // Pool of the components added as T, created on first use
         template <typename T>
-        std::vector<T *> get_all_components()
+        ComponentPool<T> &get_pool()
         {
             static_assert(std::is_base_of<Component, T>::value,
                           "Template param must be component");
 
-            std::vector<T *> ret;
-            T *tmp;
-            for (auto iter = entities_.begin(); iter != entities_.end(); iter++)
+            auto &pool = pools_[component_type_id<T>()];
+            if (!pool)
             {
-                tmp = iter->second->get_component<T>(); // it will return nullptr if not find component
-                if (tmp != nullptr)
+                pool = std::make_unique<ComponentPool<T>>();
+            }
+            return static_cast<ComponentPool<T> &>(*pool);
+        }
+
+        // Packed, valid until a component of this type is added or removed
+        template <typename T>
+        const std::vector<T *> &get_all_components()
+        {
+            return get_pool<T>().components();
+        }
+
+        // Meshes added as MeshComponent and as InstancedMeshComponent, valid until one is added or removed
+        const std::vector<MeshComponent *> &get_all_meshes() const
+        {
+            return meshes_;
+        }
+
+        /* Once per frame: recompute the stale world matrices in one flat pass, parents first, so
+           each is computed once from an up to date parent. The order is rebuilt only when entities
+           come or go or a parent changes. */
+        void update_transforms()
+        {
+            if (transform_order_stale_ || transform_order_version_ != Component::get_hierarchy_version())
+            {
+                transform_order_.clear();
+                for (auto iter = entities_.begin(); iter != entities_.end(); iter++)
                 {
-                    ret.push_back(tmp);
+                    for (auto component : iter->second->get_all_components())
+                    {
+                        if (component->get_parent() == nullptr)
+                        {
+                            transform_order_.push_back(component);
+                        }
+                    }
                 }
+                for (size_t i = 0; i < transform_order_.size(); ++i) // breadth first below the roots
+                {
+                    const auto &children = transform_order_[i]->get_children();
+                    transform_order_.insert(transform_order_.end(), children.begin(), children.end());
+                }
+                transform_order_stale_ = false;
+                transform_order_version_ = Component::get_hierarchy_version();
+            }
+            for (auto component : transform_order_)
+            {
+                component->update_world();
+            }
+        }
+
+        /* Once per frame after update_transforms: refit the BVH leaves of the meshes touched since
+           the last call (moved, directly or through a parent, or changed), add meshes that
+           finished loading, and rebuild the tree when refits have degraded it. */
+        void update_spatial_index()
+        {
+            index_work_.clear();
+            index_work_.swap(index_dirty_);
+            for (auto mesh : index_work_)
+            {
+                mesh->get_albedo_texture(); // picks up a finished load, get_world_bounds does for the mesh
+                const Bounds &bounds = mesh->get_world_bounds();
+                mesh->index_slot_ = -1; // after the polls, whose touch is covered by this refit
+                if (mesh->is_loading())
+                {
+                    mesh->queue_index(); // polled again next frame
+                }
+                if (bounds.empty())
+                {
+                    if (mesh->bvh_proxy_ >= 0)
+                    {
+                        mesh_bvh_.remove(mesh->bvh_proxy_);
+                        mesh->bvh_proxy_ = -1;
+                    }
+                }
+                else if (mesh->bvh_proxy_ < 0)
+                {
+                    mesh->bvh_proxy_ = mesh_bvh_.insert(mesh, bounds);
+                }
+                else
+                {
+                    mesh_bvh_.move(mesh->bvh_proxy_, bounds);
+                }
+            }
+            mesh_bvh_.maybe_rebuild();
+        }
+
+        /* Meshes touched since the update_spatial_index before the last one: the ones it refitted,
+           then the ones touched after it. A mesh may come twice. */
+        template <typename F>
+        void visit_touched_meshes(F &&visit) const
+        {
+            for (auto mesh : index_work_)
+            {
+                visit(mesh);
+            }
+            for (auto mesh : index_dirty_)
+            {
+                visit(mesh);
+            }
+        }
+
+        // Changes whenever a mesh is added or removed
+        uint64_t get_mesh_generation() const
+        {
+            return mesh_generation_;
+        }
+
+        // Meshes whose world box intersects the frustum, as of the last update_spatial_index
+        template <typename F>
+        void query_meshes(const Frustum &frustum, F &&visit) const
+        {
+            mesh_bvh_.query(frustum, visit);
+        }
+
+        // Meshes whose world box reaches into the sphere, e.g. a light's range
+        template <typename F>
+        void query_meshes(const float center[3], float radius, F &&visit) const
+        {
+            mesh_bvh_.query(center, radius, visit);
+        }
+
+        size_t indexed_mesh_count() const
+        {
+            return mesh_bvh_.size();
+        }
+
+        /* Closest mesh hit by the ray origin + t * dir, tested against its triangles; nullptr if
+           none. t is written to t_p in units of dir. */
+        MeshComponent *pick(const Vector3f &origin, const Vector3f &dir, float *t_p = nullptr, float max_t = FLT_MAX) const
+        {
+            float o[3] = {origin[0], origin[1], origin[2]};
+            float d[3] = {dir[0], dir[1], dir[2]};
+            MeshComponent *ret = nullptr;
+            float t = mesh_bvh_.raycast(
+                o, d, max_t, [&](MeshComponent *mesh, float)
+                { return intersect_triangles(mesh, o, d); },
+                &ret);
+            if (t < 0.f)
+            {
+                return nullptr;
+            }
+            if (t_p != nullptr)
+            {
+                *t_p = t;
             }
             return ret;
         }
@@ -99,8 +354,108 @@ namespace Core
         {
             return sid_;
         }
+
+    private:
+        // Nearest triangle hit over the mesh's instances, -1 if none
+        static float intersect_triangles(MeshComponent *mesh, const float o[3], const float d[3])
+        {
+            const MeshData *data = mesh->get_mesh_data();
+            if (data == nullptr)
+            {
+                return -1.f;
+            }
+            if (!mesh->is_instanced())
+            {
+                return intersect_model(*data, mesh->getM(), o, d);
+            }
+            auto instanced = static_cast<InstancedMeshComponent *>(mesh);
+            float best = -1.f;
+            for (size_t i = 0; i < instanced->instance_count(); ++i)
+            {
+                // Skip instances whose bounding sphere the ray misses
+                Bounds b = instanced->get_instance_world_bounds(i);
+                float oc[3] = {b.center[0] - o[0], b.center[1] - o[1], b.center[2] - o[2]};
+                float t = std::max(0.f, (oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2]) / (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+                float gap[3] = {oc[0] - t * d[0], oc[1] - t * d[1], oc[2] - t * d[2]};
+                if (gap[0] * gap[0] + gap[1] * gap[1] + gap[2] * gap[2] > b.radius * b.radius)
+                {
+                    continue;
+                }
+                t = intersect_model(*data, instanced->get_instance_world_matrix(i), o, d);
+                if (t >= 0.f && (best < 0.f || t < best))
+                {
+                    best = t;
+                }
+            }
+            return best;
+        }
+
+        // Nearest triangle hit in model space (Moller & Trumbore), t is unchanged by the affine map
+        static float intersect_model(const MeshData &data, const Matrix4f &M, const float o[3], const float d[3])
+        {
+            Matrix4f inv = affine_inverse(M);
+            float mo[3], md[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                mo[i] = inv[i][3];
+                md[i] = 0.f;
+                for (int j = 0; j < 3; ++j)
+                {
+                    mo[i] += inv[i][j] * o[j];
+                    md[i] += inv[i][j] * d[j];
+                }
+            }
+            const float *p = data.positions();
+            const uint32_t *index = data.indices();
+            float best = -1.f;
+            for (size_t f = 0; f < data.triangle_count(); ++f)
+            {
+                const float *a = p + 3 * index[3 * f];
+                const float *b = p + 3 * index[3 * f + 1];
+                const float *c = p + 3 * index[3 * f + 2];
+                float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                float pv[3] = {md[1] * e2[2] - md[2] * e2[1], md[2] * e2[0] - md[0] * e2[2], md[0] * e2[1] - md[1] * e2[0]};
+                float det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+                if (std::abs(det) < 1e-12f)
+                {
+                    continue;
+                }
+                float tv[3] = {mo[0] - a[0], mo[1] - a[1], mo[2] - a[2]};
+                float u = (tv[0] * pv[0] + tv[1] * pv[1] + tv[2] * pv[2]) / det;
+                if (u < 0.f || u > 1.f)
+                {
+                    continue;
+                }
+                float qv[3] = {tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2], tv[0] * e1[1] - tv[1] * e1[0]};
+                float v = (md[0] * qv[0] + md[1] * qv[1] + md[2] * qv[2]) / det;
+                if (v < 0.f || u + v > 1.f)
+                {
+                    continue;
+                }
+                float t = (e2[0] * qv[0] + e2[1] * qv[1] + e2[2] * qv[2]) / det;
+                if (t >= 0.f && (best < 0.f || t < best))
+                {
+                    best = t;
+                }
+            }
+            return best;
+        }
     };
 
+    template <typename T>
+    void attach_component(Scene *scene, Entity *entity, size_t i)
+    {
+        Entity::PoolEntry &entry = entity->pool_entries_[i];
+        ComponentPool<T> &pool = scene->get_pool<T>();
+        entry.pool = &pool;
+        entry.handle = pool.add(static_cast<T *>(entity->components_[i]), entity);
+        if constexpr (std::is_base_of<MeshComponent, T>::value)
+        {
+            scene->add_mesh(static_cast<T *>(entity->components_[i]));
+        }
+    }
+
     Scene *current_scene = nullptr;
     void cd_to_scene(Scene *scene)
     {
@@ -134,6 +489,24 @@ namespace Core
         }
         return current_scene->get_entity(eid);
     }
+    Entity *get_entity(EntityId uid)
+    {
+        if (!current_scene)
+        {
+            std::cerr << "Current scene is empty" << std::endl;
+            exit(-1);
+        }
+        return current_scene->get_entity(uid);
+    }
+    Entity *get_entity_by_name(NameId name)
+    {
+        if (!current_scene)
+        {
+            std::cerr << "Current scene is empty" << std::endl;
+            exit(-1);
+        }
+        return current_scene->get_entity_by_name(name);
+    }
     std::vector<Entity *> get_all_entities()
     {
         if (!current_scene)
@@ -144,7 +517,7 @@ namespace Core
         return current_scene->get_all_entities();
     }
     template <typename T>
-    std::vector<T *> get_all_components()
+    const std::vector<T *> &get_all_components()
     {
         if (!current_scene)
         {
@@ -157,41 +530,41 @@ namespace Core
     class SceneFactory
     {
     public:
-        static Scene *build_default_scene()
+        static Scene *build_default_scene(const std::string &asset_root = "../../obj/")
         {
             Scene *scene = new Scene("Default");
 
             // scene
-            //     ->add_entity(new Entity("TestObj"))                                                                     //
-            //     ->add_component(new MeshComponent())                                                                    //
-            //     ->load_vertexes("../../obj/cube.obj")                                                                   //
-            //     ->set_albedo_texture(Utils::convert_TGAImage_to_CoreImage(Utils::TGAImage("../../obj/colormap24.tga"))) //
-            //     ->set_scala(Vector3f{1, 1, 1})                                                                          //
+            //     ->add_entity(new Entity("TestObj"))                       //
+            //     ->add_component(new MeshComponent())                      //
+            //     ->load_vertexes_async(asset_root + "cube.obj")            //
+            //     ->set_albedo_texture_async(asset_root + "colormap24.tga") //
+            //     ->set_scala(Vector3f{1, 1, 1})                            //
             //     ->set_position(Vector3f{0, 0.5f, 0});
 
             // scene
-            //     ->add_entity(new Entity("HelmetObj"))                                                                              //
-            //     ->add_component(new MeshComponent())                                                                               //
-            //     ->load_vertexes("../../obj/helmet/helmet.obj")                                                                     //
-            //     ->set_albedo_texture(Utils::convert_TGAImage_to_CoreImage(Utils::TGAImage("../../obj/helmet/helmet_diffuse.tga"))) //
-            //     ->set_scala(Vector3f{0.6, 0.6, 0.6})                                                                               //
-            //     ->set_position(Vector3f{0, 0.6, 0});                                                                                 //
+            //     ->add_entity(new Entity("HelmetObj"))                                //
+            //     ->add_component(new MeshComponent())                                 //
+            //     ->load_vertexes_async(asset_root + "helmet/helmet.obj")              //
+            //     ->set_albedo_texture_async(asset_root + "helmet/helmet_diffuse.tga") //
+            //     ->set_scala(Vector3f{0.6, 0.6, 0.6})                                 //
+            //     ->set_position(Vector3f{0, 0.6, 0});                                 //
 
             // scene
-            //     ->add_entity(new Entity("MaryObj"))                                                                                    //
-            //     ->add_component(new MeshComponent())                                                                                   //
-            //     ->load_vertexes("../../obj/marry/Marry.obj")                                                                           //
-            //     ->set_albedo_texture(Utils::convert_TGAImage_to_CoreImage(Utils::TGAImage("../../obj/marry/MC003_Kozakura_Mari.tga"))) //
-            //     ->set_scala(Vector3f{0.5, 0.5, 0.5})                                                                                   //
-            //     ->set_position(Vector3f{0, -1, 0});                                                                                    //
+            //     ->add_entity(new Entity("MaryObj"))                                      //
+            //     ->add_component(new MeshComponent())                                     //
+            //     ->load_vertexes_async(asset_root + "marry/Marry.obj")                    //
+            //     ->set_albedo_texture_async(asset_root + "marry/MC003_Kozakura_Mari.tga") //
+            //     ->set_scala(Vector3f{0.5, 0.5, 0.5})                                     //
+            //     ->set_position(Vector3f{0, -1, 0});                                      //
 
             scene
-                ->add_entity(new Entity("FloorObj"))                                                                             //
-                ->add_component(new MeshComponent())                                                                             //
-                ->load_vertexes("../../obj/floor/floor.obj")                                                                     //
-                ->set_albedo_texture(Utils::convert_TGAImage_to_CoreImage(Utils::TGAImage("../../obj/floor/floor_diffuse.tga"))) //
-                ->set_scala(Vector3f{1, 1, 1})                                                                                   //
-                ->set_position(Vector3f{0, 0, 0});                                                                               //
+                ->add_entity(new Entity("FloorObj"))                               //
+                ->add_component(new MeshComponent())                               //
+                ->load_vertexes_async(asset_root + "floor/floor.obj")              //
+                ->set_albedo_texture_async(asset_root + "floor/floor_diffuse.tga") //
+                ->set_scala(Vector3f{1, 1, 1})                                     //
+                ->set_position(Vector3f{0, 0, 0});                                 //
 
             Vector3f main_camera_pos{0.f, 1.5f, 1.5f};
             scene
@@ -1,6 +1,9 @@
 #ifndef ERER_CORE_SHADER_H_
 #define ERER_CORE_SHADER_H_
 
+#include <vector>
+#include <algorithm> // for std::clamp
+
 #include "data_structure.hpp"
 #include "image.h"
 #include "../utils/math.h"
@@ -10,8 +13,10 @@ namespace Core
     struct MeshAttribute
     {
         Matrix4f M;
-        Image<Vector4c> albedo; // control the primary color of the surface
+        const Image<RGBA8> *albedo = nullptr; // control the primary color of the surface, a view of the mesh's shared texture
         float gloss;
+        const float *tint = nullptr; // rgba of an instance, multiplies the albedo; nullptr for none
+        float opacity = 1.f;         // multiplies the albedo alpha
     };
 
     struct LightAttribute
@@ -127,22 +132,53 @@ namespace Core
             return vo;
         }
 
-        Vector4c frag(FragmentInput fi, const LightAttribute& la, const CameraAttribute& ca, const MeshAttribute& ma, float cover_rate)
+        Vector4f surface_albedo(const FragmentInput& fi, const MeshAttribute& ma)
+        {
+            Vector4f albedo = Utils::tone_mapping(ma.albedo->sampling(fi.I_UV[0], 1 - fi.I_UV[1]));
+            if (ma.tint != nullptr)
+            {
+                for (int k = 0; k < 4; ++k)
+                {
+                    albedo[k] *= ma.tint[k];
+                }
+            }
+            return albedo;
+        }
+
+        // Linear color from one light
+        Vector3f shade(const FragmentInput& fi, const LightAttribute& la, const CameraAttribute& ca, const MeshAttribute& ma, const Vector4f& albedo)
         {
             Vector3f world_half_dir = (ca.camera_postion - fi.IWS_POSITION.reshape<3>() - la.world_light_dir).normal(); // light/world dir must reverse to keep the half vector on the same side with the normal vector
-            Vector3f diffuse = la.light_color * Utils::tone_mapping(cover_rate * ma.albedo.sampling(fi.I_UV[0], 1 - fi.I_UV[1])).reshape<3>() * la.light_intensity * std::max(0.f, Utils::dot_product(fi.IWS_NORMAL, -1 * la.world_light_dir));
+            Vector3f diffuse = la.light_color * albedo.reshape<3>() * la.light_intensity * std::max(0.f, Utils::dot_product(fi.IWS_NORMAL, -1 * la.world_light_dir));
             Vector3f specular = la.light_color * la.specular_color * la.light_intensity * std::pow(std::max(0.f, Utils::dot_product(fi.IWS_NORMAL, world_half_dir)), ma.gloss);
-            Vector3f tmp = diffuse + la.ambient + specular;
+            return diffuse + la.ambient + specular;
+        }
+
+        // Opaque fragment lit by one light, partial coverage darkens the diffuse term
+        RGBA8 frag(FragmentInput fi, const LightAttribute& la, const CameraAttribute& ca, const MeshAttribute& ma, float cover_rate)
+        {
+            Vector4f albedo = surface_albedo(fi, ma);
+            Vector3f tmp = shade(fi, la, ca, ma, albedo * cover_rate);
             // Vector3f tmp = diffuse; // Test
-            return Vector4c{ static_cast<uint8_t>(Utils::saturate(tmp[0]) * 255),
-                            static_cast<uint8_t>(Utils::saturate(tmp[1]) * 255),
-                            static_cast<uint8_t>(Utils::saturate(tmp[2]) * 255),
-                            0 };
+            return Utils::inverse_tone_mapping(tmp, 255);
             // return Vector4i{static_cast<int>(Utils::saturate(0) * 255),
             //                 static_cast<int>(Utils::saturate(0) * 255),
             //                 static_cast<int>(Utils::saturate(0) * 255),
             //                 0};
         }
+
+        // Blended fragment lit by every light; coverage is left to the caller, which scales the alpha with it
+        RGBA8 frag(FragmentInput fi, const std::vector<LightAttribute>& las, const CameraAttribute& ca, const MeshAttribute& ma)
+        {
+            Vector4f albedo = surface_albedo(fi, ma);
+            Vector3f tmp{ 0.f, 0.f, 0.f };
+            for (const LightAttribute& la : las)
+            {
+                tmp = tmp + shade(fi, la, ca, ma, albedo);
+            }
+            uint8_t alpha = static_cast<uint8_t>(std::clamp(albedo[3] * ma.opacity, 0.f, 1.f) * 255 + 0.5f);
+            return Utils::inverse_tone_mapping(tmp, alpha);
+        }
     }
 
 }
@@ -0,0 +1,425 @@
+#ifndef ERER_CORE_SIMPLIFY_H_
+#define ERER_CORE_SIMPLIFY_H_
+
+#include <vector>
+#include <queue>
+#include <array>
+#include <functional> // for std::hash std::greater
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef> // for size_t
+
+namespace Core
+{
+    // Sum of squared distances to a set of planes, as the symmetric 4x4 matrix of Garland & Heckbert
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+
+        // Plane n.p + d = 0 with unit n
+        static Quadric plane(double nx, double ny, double nz, double d, double weight)
+        {
+            Quadric q;
+            q.a00 = weight * nx * nx, q.a01 = weight * nx * ny, q.a02 = weight * nx * nz, q.a03 = weight * nx * d;
+            q.a11 = weight * ny * ny, q.a12 = weight * ny * nz, q.a13 = weight * ny * d;
+            q.a22 = weight * nz * nz, q.a23 = weight * nz * d;
+            q.a33 = weight * d * d;
+            return q;
+        }
+
+        Quadric &operator+=(const Quadric &o)
+        {
+            a00 += o.a00, a01 += o.a01, a02 += o.a02, a03 += o.a03;
+            a11 += o.a11, a12 += o.a12, a13 += o.a13;
+            a22 += o.a22, a23 += o.a23;
+            a33 += o.a33;
+            return *this;
+        }
+
+        double error(const float p[3]) const
+        {
+            double x = p[0], y = p[1], z = p[2];
+            return a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x +
+                   a11 * y * y + 2 * a12 * y * z + 2 * a13 * y +
+                   a22 * z * z + 2 * a23 * z + a33;
+        }
+    };
+
+    /* Quadric error metric simplification with half edge collapses: a vertex moves onto one of its
+       neighbours, so every result indexes the original vertex buffer and LODs share it.
+       Attribute seams (UV or normal discontinuities) split a position into several vertices. A
+       seam vertex with two wedges only moves along the seam, together with its twin on the other
+       side, so texturing stays continuous; seam corners, open borders and non manifold vertices
+       never move. Collapses that would flip a triangle are rejected. Besides the distance to the
+       original surface, a collapse costs for the UVs and normals it drags across the triangles
+       of the moved vertex, which keeps texturing and shading from stretching.
+       Returns one index buffer per target triangle count, in the order given (decreasing); a
+       target that can't be reached gets the smallest mesh found. */
+    inline std::vector<std::vector<uint32_t>> simplify_lod_chain(const float *positions, const float *normals, const float *uvs, size_t vertex_count,
+                                                                 const uint32_t *indices, size_t index_count,
+                                                                 const std::vector<size_t> &target_triangle_counts)
+    {
+        enum Kind : uint8_t
+        {
+            Free = 0, // one wedge, interior
+            Seam,     // two wedges, on a seam running through
+            Locked
+        };
+        size_t triangle_count = index_count / 3;
+        std::vector<uint32_t> tris(indices, indices + triangle_count * 3);
+        std::vector<uint8_t> tri_alive(triangle_count, 1);
+        std::vector<std::vector<uint32_t>> vertex_tris(vertex_count);
+        std::vector<uint8_t> removed(vertex_count, 0);
+        std::vector<uint32_t> stamp(vertex_count, 0); // bumped when a vertex's neighbourhood changes
+
+        // Wedges: vertices sharing a position, the quadric belongs to the position
+        std::vector<uint32_t> group(vertex_count);
+        std::vector<std::vector<uint32_t>> wedges(vertex_count);
+        {
+            struct PositionHash
+            {
+                size_t operator()(const std::array<float, 3> &p) const
+                {
+                    return std::hash<float>()(p[0]) * 73856093u ^ std::hash<float>()(p[1]) * 19349663u ^ std::hash<float>()(p[2]) * 83492791u;
+                }
+            };
+            std::unordered_map<std::array<float, 3>, uint32_t, PositionHash> first;
+            first.reserve(vertex_count);
+            for (uint32_t v = 0; v < vertex_count; ++v)
+            {
+                group[v] = first.emplace(std::array<float, 3>{positions[3 * v], positions[3 * v + 1], positions[3 * v + 2]}, v).first->second;
+                wedges[group[v]].push_back(v);
+            }
+        }
+        std::vector<Quadric> quadrics(vertex_count); // by group
+        std::vector<double> areas(vertex_count, 0.); // of the triangles around each group, weights the attribute cost
+
+        auto normal_of = [&](uint32_t a, uint32_t b, uint32_t c, const float *pa, double n[3])
+        {
+            const float *p0 = pa != nullptr ? pa : positions + 3 * a;
+            const float *p1 = positions + 3 * b;
+            const float *p2 = positions + 3 * c;
+            double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            return std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]); // twice the area
+        };
+        auto edge_key = [](uint32_t a, uint32_t b)
+        {
+            return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+        };
+
+        std::unordered_map<uint64_t, int> edge_uses;    // by vertex
+        std::unordered_map<uint64_t, int> position_uses; // by group
+        edge_uses.reserve(triangle_count * 3);
+        position_uses.reserve(triangle_count * 3);
+        for (size_t t = 0; t < triangle_count; ++t)
+        {
+            uint32_t v[3] = {tris[3 * t], tris[3 * t + 1], tris[3 * t + 2]};
+            double n[3];
+            double len = normal_of(v[0], v[1], v[2], nullptr, n);
+            for (int k = 0; k < 3; ++k)
+            {
+                vertex_tris[v[k]].push_back(static_cast<uint32_t>(t));
+                ++edge_uses[edge_key(v[k], v[(k + 1) % 3])];
+                ++position_uses[edge_key(group[v[k]], group[v[(k + 1) % 3]])];
+            }
+            if (len > 0)
+            {
+                const float *p = positions + 3 * v[0];
+                double nx = n[0] / len, ny = n[1] / len, nz = n[2] / len;
+                Quadric q = Quadric::plane(nx, ny, nz, -(nx * p[0] + ny * p[1] + nz * p[2]), len / 2); // area weighted
+                for (int k = 0; k < 3; ++k)
+                {
+                    quadrics[group[v[k]]] += q;
+                    areas[group[v[k]]] += len / 2;
+                }
+            }
+        }
+
+        // Attribute errors in squared lengths: UVs through the mesh's world area per UV area,
+        // normals through the mean edge length
+        double uv_scale2 = 0., normal_scale2 = 0.;
+        {
+            double area = 0., uv_area = 0., edges = 0.;
+            for (size_t t = 0; t < triangle_count; ++t)
+            {
+                const uint32_t *v = &tris[3 * t];
+                double n[3];
+                area += normal_of(v[0], v[1], v[2], nullptr, n) / 2;
+                if (uvs != nullptr)
+                {
+                    const float *a = uvs + 2 * v[0], *b = uvs + 2 * v[1], *c = uvs + 2 * v[2];
+                    uv_area += std::abs((b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0])) / 2;
+                }
+                for (int k = 0; k < 3; ++k)
+                {
+                    const float *p = positions + 3 * v[k], *q = positions + 3 * v[(k + 1) % 3];
+                    edges += std::sqrt((p[0] - q[0]) * (p[0] - q[0]) + (p[1] - q[1]) * (p[1] - q[1]) + (p[2] - q[2]) * (p[2] - q[2]));
+                }
+            }
+            uv_scale2 = uv_area > 0. ? area / uv_area : 0.;
+            double mean_edge = triangle_count ? edges / (3 * triangle_count) : 0.;
+            normal_scale2 = normals != nullptr ? mean_edge * mean_edge : 0.;
+        }
+        auto attribute_error = [&](uint32_t from, uint32_t to)
+        {
+            double e = 0.;
+            for (int k = 0; uvs != nullptr && k < 2; ++k)
+            {
+                double d = uvs[2 * from + k] - uvs[2 * to + k];
+                e += uv_scale2 * d * d;
+            }
+            for (int k = 0; normals != nullptr && k < 3; ++k)
+            {
+                double d = normals[3 * from + k] - normals[3 * to + k];
+                e += normal_scale2 * d * d;
+            }
+            return e * areas[group[from]];
+        };
+        std::vector<uint8_t> kind(vertex_count, Free);
+        std::vector<uint8_t> seam_edges(vertex_count, 0);
+        for (const auto &edge : edge_uses)
+        {
+            uint32_t a = static_cast<uint32_t>(edge.first >> 32), b = static_cast<uint32_t>(edge.first & 0xFFFFFFFFu);
+            int around = position_uses[edge_key(group[a], group[b])];
+            if (around != 2 || edge.second > 2)
+            {
+                kind[a] = kind[b] = Locked; // open border or non manifold
+            }
+            else if (edge.second == 1)
+            {
+                seam_edges[a] = static_cast<uint8_t>(std::min(seam_edges[a] + 1, 255));
+                seam_edges[b] = static_cast<uint8_t>(std::min(seam_edges[b] + 1, 255));
+            }
+        }
+        for (uint32_t v = 0; v < vertex_count; ++v)
+        {
+            size_t n = wedges[group[v]].size();
+            if (kind[v] == Locked || (n == 1 && seam_edges[v] == 0))
+            {
+                continue;
+            }
+            kind[v] = n == 2 && seam_edges[v] == 2 ? Seam : Locked;
+        }
+        for (uint32_t v = 0; v < vertex_count; ++v)
+        {
+            if (kind[v] == Seam && kind[wedges[group[v]][0]] != Seam)
+            {
+                kind[v] = Locked; // the twin is a seam end
+            }
+            if (kind[v] == Seam && kind[wedges[group[v]][1]] != Seam)
+            {
+                kind[v] = Locked;
+            }
+        }
+
+        // Alive triangles using both a and b
+        auto shared_triangles = [&](uint32_t a, uint32_t b)
+        {
+            int n = 0;
+            for (uint32_t t : vertex_tris[a])
+            {
+                const uint32_t *v = &tris[3 * t];
+                n += tri_alive[t] && (v[0] == b || v[1] == b || v[2] == b);
+            }
+            return n;
+        };
+        auto twin_of = [&](uint32_t v)
+        {
+            const auto &w = wedges[group[v]];
+            return w[0] == v ? w[1] : w[0];
+        };
+        // The vertex on the other side of the seam edge (from, to): the wedge of `to` next to from's twin
+        auto twin_target = [&](uint32_t from, uint32_t to) -> int64_t
+        {
+            uint32_t twin = twin_of(from);
+            for (uint32_t u : wedges[group[to]])
+            {
+                if (u != to && !removed[u] && shared_triangles(twin, u) == 1)
+                {
+                    return u;
+                }
+            }
+            return -1;
+        };
+
+        struct Collapse
+        {
+            double cost;
+            uint32_t from, to;
+            uint32_t from_stamp, to_stamp;
+            bool operator>(const Collapse &o) const
+            {
+                return cost > o.cost;
+            }
+        };
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+        auto push = [&](uint32_t from, uint32_t to)
+        {
+            if (kind[from] == Locked || group[from] == group[to])
+            {
+                return;
+            }
+            Quadric q = quadrics[group[from]];
+            q += quadrics[group[to]];
+            heap.push({q.error(positions + 3 * to) + attribute_error(from, to), from, to, stamp[from], stamp[to]});
+        };
+        auto push_collapses = [&](uint32_t v)
+        {
+            for (uint32_t t : vertex_tris[v])
+            {
+                if (!tri_alive[t])
+                {
+                    continue;
+                }
+                for (int k = 0; k < 3; ++k)
+                {
+                    uint32_t u = tris[3 * t + k];
+                    if (u != v)
+                    {
+                        push(v, u);
+                        push(u, v);
+                    }
+                }
+            }
+        };
+        for (uint32_t v = 0; v < vertex_count; ++v)
+        {
+            if (kind[v] != Locked)
+            {
+                push_collapses(v);
+            }
+        }
+
+        // Moving `from` onto `to` must not flip or degenerate the triangles that keep both corners apart
+        auto can_move = [&](uint32_t from, uint32_t to)
+        {
+            const float *target = positions + 3 * to;
+            for (uint32_t t : vertex_tris[from])
+            {
+                if (!tri_alive[t])
+                {
+                    continue;
+                }
+                uint32_t *v = &tris[3 * t];
+                if (v[0] == to || v[1] == to || v[2] == to)
+                {
+                    continue; // collapses away
+                }
+                int k = v[0] == from ? 0 : (v[1] == from ? 1 : 2);
+                double before[3], after[3];
+                double len_before = normal_of(v[k], v[(k + 1) % 3], v[(k + 2) % 3], nullptr, before);
+                double len_after = normal_of(v[k], v[(k + 1) % 3], v[(k + 2) % 3], target, after);
+                if (len_after <= 1e-12 * len_before ||
+                    before[0] * after[0] + before[1] * after[1] + before[2] * after[2] < 0.2 * len_before * len_after)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        size_t alive = triangle_count;
+        std::vector<uint32_t> ring;
+        auto move = [&](uint32_t from, uint32_t to)
+        {
+            for (uint32_t t : vertex_tris[from])
+            {
+                if (!tri_alive[t])
+                {
+                    continue;
+                }
+                uint32_t *v = &tris[3 * t];
+                if (v[0] == to || v[1] == to || v[2] == to)
+                {
+                    tri_alive[t] = 0;
+                    --alive;
+                    ring.insert(ring.end(), v, v + 3);
+                    continue;
+                }
+                for (int k = 0; k < 3; ++k)
+                {
+                    v[k] = v[k] == from ? to : v[k];
+                }
+                ring.insert(ring.end(), v, v + 3);
+                vertex_tris[to].push_back(t);
+            }
+            removed[from] = 1;
+            vertex_tris[from].clear();
+        };
+
+        std::vector<std::vector<uint32_t>> ret;
+        for (size_t target : target_triangle_counts)
+        {
+            while (alive > target && !heap.empty())
+            {
+                Collapse c = heap.top();
+                heap.pop();
+                if (removed[c.from] || removed[c.to] || stamp[c.from] != c.from_stamp || stamp[c.to] != c.to_stamp)
+                {
+                    continue; // stale
+                }
+                int64_t twin_to = -1;
+                if (kind[c.from] == Seam)
+                {
+                    if (shared_triangles(c.from, c.to) != 1 || (twin_to = twin_target(c.from, c.to)) < 0)
+                    {
+                        continue; // only along the seam
+                    }
+                    if (!can_move(twin_of(c.from), static_cast<uint32_t>(twin_to)))
+                    {
+                        continue;
+                    }
+                }
+                if (!can_move(c.from, c.to))
+                {
+                    continue;
+                }
+                uint32_t group_from = group[c.from];
+                ring.clear();
+                if (twin_to >= 0)
+                {
+                    move(twin_of(c.from), static_cast<uint32_t>(twin_to));
+                }
+                move(c.from, c.to);
+                quadrics[group[c.to]] += quadrics[group_from];
+                areas[group[c.to]] += areas[group_from];
+                std::sort(ring.begin(), ring.end());
+                ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+                for (uint32_t v : ring)
+                {
+                    ++stamp[v]; // their costs involve the changed triangles
+                }
+                for (uint32_t v : ring)
+                {
+                    if (!removed[v])
+                    {
+                        push_collapses(v);
+                    }
+                }
+            }
+
+            std::vector<uint32_t> out;
+            out.reserve(alive * 3);
+            for (size_t t = 0; t < triangle_count; ++t)
+            {
+                if (tri_alive[t])
+                {
+                    out.insert(out.end(), tris.begin() + 3 * t, tris.begin() + 3 * t + 3);
+                }
+            }
+            ret.push_back(std::move(out));
+        }
+        return ret;
+    }
+}
+
+#endif // ERER_CORE_SIMPLIFY_H_
@@ -0,0 +1,73 @@
+#ifndef ERER_CORE_STATS_H_
+#define ERER_CORE_STATS_H_
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <iostream>
+
+namespace Core
+{
+    // Named per-frame measurements: the latest value of each plus a bounded history, readable from
+    // any thread (the renderer records on its worker, front ends print on the main thread)
+    class Stats
+    {
+    public:
+        static constexpr size_t HISTORY_SIZE = 120;
+
+    private:
+        static std::map<std::string, std::deque<double>> values_;
+        static std::mutex mutex_;
+
+    public:
+        static void record(const std::string &name, double value)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto &history = values_[name];
+            history.push_back(value);
+            if (history.size() > HISTORY_SIZE)
+            {
+                history.pop_front();
+            }
+        }
+
+        // Latest value, 0 if the name was never recorded
+        static double get(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = values_.find(name);
+            return it == values_.end() ? 0. : it->second.back();
+        }
+
+        // Oldest first
+        static std::vector<double> history(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = values_.find(name);
+            return it == values_.end() ? std::vector<double>() : std::vector<double>(it->second.begin(), it->second.end());
+        }
+
+        static void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            values_.clear();
+        }
+
+        // One line of name=value pairs
+        static void print(std::ostream &out)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto &value : values_)
+            {
+                out << value.first << "=" << value.second.back() << " ";
+            }
+            out << std::endl;
+        }
+    };
+
+    std::map<std::string, std::deque<double>> Stats::values_;
+    std::mutex Stats::mutex_;
+}
+
+#endif // ERER_CORE_STATS_H_
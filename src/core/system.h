@@ -6,14 +6,26 @@
 #include <memory>   // for smart pointer
 #include <stdlib.h> // for math
 #include <float.h>  // for FLT_MAX
+#include <climits>  // for LLONG_MAX
 #include <chrono>   // for std::chrono
 #include <random>   // for std::default_random_engine
+#include <stdexcept> // for std::runtime_error
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 
 #include "scene.h"
 #include "shader.h"
 #include "time.h"
+#include "stats.h"
+#include "bounds.h"
+#include "occlusion.h"
+#include "render_queue.h"
 #include "../settings.h"
 #include "../utils/math.h"
+#include "../utils/thread_pool.h"
 
 namespace Core
 {
@@ -39,6 +51,331 @@ namespace Core
     private:
         std::vector<CameraComponent*> depth_cameras_;
 
+        // Half-open pixel rectangle [x0, x1) x [y0, y1)
+        struct ScreenRect
+        {
+            int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+            bool empty() const
+            {
+                return x0 >= x1 || y0 >= y1;
+            }
+            bool overlaps(const ScreenRect& other) const
+            {
+                return !empty() && !other.empty() && x0 < other.x1 && other.x0 < x1 && y0 < other.y1 && other.y0 < y1;
+            }
+            ScreenRect unite(const ScreenRect& other) const
+            {
+                if (empty())
+                {
+                    return other;
+                }
+                if (other.empty())
+                {
+                    return *this;
+                }
+                return { std::min(x0, other.x0), std::min(y0, other.y0), std::max(x1, other.x1), std::max(y1, other.y1) };
+            }
+            ScreenRect intersect(const ScreenRect& other) const
+            {
+                return { std::max(x0, other.x0), std::max(y0, other.y0), std::min(x1, other.x1), std::min(y1, other.y1) };
+            }
+            long long area() const
+            {
+                return empty() ? 0 : static_cast<long long>(x1 - x0) * (y1 - y0);
+            }
+        };
+        using Region = std::vector<ScreenRect>; // disjoint rectangles to repaint
+        static constexpr size_t MAX_REGION_RECTS = 8;
+
+        /* Dirty tracking for incremental frames. A mesh whose version changed damages its screen
+           bounds of the last frame and of this one; anything else (camera, light, scene) repaints
+           the whole target. */
+        struct MeshBounds
+        {
+            const CameraComponent* camera = nullptr;
+            uint64_t mesh_version = 0, camera_version = 0; // of projected
+            ScreenRect projected;
+            uint64_t visible_frame = 0; // projected is covered only in that frame, culled meshes cover nothing
+        };
+        struct MeshRecord
+        {
+            uint64_t version = 0;           // at the last rendered frame
+            uint64_t seen_frame = 0;        // to drop removed meshes
+            uint64_t changed_frame = 0;     // last frame that repainted it, a touched mesh may be visited twice
+            std::vector<MeshBounds> bounds; // one per camera that saw the mesh, kept across frames
+            MeshBounds& of(const CameraComponent* camera)
+            {
+                for (auto& b : bounds)
+                {
+                    if (b.camera == camera)
+                    {
+                        return b;
+                    }
+                }
+                bounds.push_back(MeshBounds());
+                bounds.back().camera = camera;
+                return bounds.back();
+            }
+        };
+        struct CameraRecord
+        {
+            uint64_t version = 0;
+            std::deque<Region> damage; // of the previous frames, newest first, for targets older than one frame
+        };
+        bool incremental_ = true;
+        std::vector<uint64_t> scene_signature_; // components and light versions of the last frame
+        uint64_t frame_ = 0; // plan_frame calls
+        std::unordered_map<const MeshComponent*, MeshRecord> mesh_records_;
+        std::unordered_map<const CameraComponent*, CameraRecord> camera_records_;
+        std::unordered_map<const CameraComponent*, Region> scissor_; // what Pass repaints this frame
+
+        struct CullCount
+        {
+            int visible = 0;
+            int culled = 0;
+            int occluded = 0;
+            long long triangles = 0; // of the selected LODs
+            int instances = 0;        // of instanced meshes, drawn
+            int culled_instances = 0; // likewise, outside the frustum or occluded
+        };
+        std::unordered_map<const CameraComponent*, CullCount> cull_counts_; // of this frame
+        std::unordered_map<const CameraComponent*, std::vector<MeshComponent*>> visible_; // this frame, in scene BVH order
+        struct VisibleInstances
+        {
+            struct Group
+            {
+                size_t lod;
+                size_t end; // in instances, the group starts where the previous one ends
+            };
+            std::vector<uint32_t> instances; // grouped by LOD once select_lods ran, finest first
+            std::vector<Group> groups;
+        };
+        std::unordered_map<const CameraComponent*, std::unordered_map<const MeshComponent*, VisibleInstances>> visible_instances_; // of the visible instanced meshes
+
+        // Occluders drawn into a camera's occlusion buffer, the largest first
+        static constexpr size_t MAX_OCCLUDERS = 8;
+        static constexpr size_t OCCLUDER_MAX_TRIANGLES = 4096; // for automatic selection
+        static constexpr float OCCLUDER_MIN_SCREEN_FRACTION = 0.02f; // likewise
+        bool occlusion_culling_ = true;
+        std::unordered_map<const CameraComponent*, OcclusionBuffer> occlusion_buffers_;
+        std::unordered_map<const CameraComponent*, const OcclusionBuffer*> occlusion_used_; // this frame, maybe another camera's buffer
+
+        // Sorted draw commands of every camera, recorded on the worker threads once a camera sees enough meshes
+        static constexpr size_t PARALLEL_RECORD_MIN = 1024;
+        std::unordered_map<const CameraComponent*, RenderQueue<MeshComponent*>> queues_;
+
+        static Utils::ThreadPool& record_pool()
+        {
+            static Utils::ThreadPool pool;
+            return pool;
+        }
+
+        static void add_rect(Region& region, ScreenRect rect)
+        {
+            if (rect.empty())
+            {
+                return;
+            }
+            // Absorb everything it touches, the grown rectangle may touch earlier ones again
+            for (size_t i = 0; i < region.size();)
+            {
+                if (region[i].overlaps(rect))
+                {
+                    rect = rect.unite(region[i]);
+                    region.erase(region.begin() + i);
+                    i = 0;
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            region.push_back(rect);
+            if (region.size() > MAX_REGION_RECTS)
+            {
+                ScreenRect all;
+                for (const auto& r : region)
+                {
+                    all = all.unite(r);
+                }
+                region = Region{ all };
+            }
+        }
+
+        static bool overlaps(const Region& region, const ScreenRect& rect)
+        {
+            for (const auto& r : region)
+            {
+                if (r.overlaps(rect))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static ScreenRect full_rect(CameraComponent* camera)
+        {
+            return { 0, 0, camera->get_width(), camera->get_height() };
+        }
+
+        // World space corners of a model space box
+        static std::vector<Vector3f> box_corners(const Vector3f& lo, const Vector3f& hi, const Matrix4f& M)
+        {
+            std::vector<Vector3f> ret;
+            for (int c = 0; c < 8; ++c)
+            {
+                Vector4f p{ c & 1 ? hi[0] : lo[0], c & 2 ? hi[1] : lo[1], c & 4 ? hi[2] : lo[2], 1.f };
+                ret.push_back(M.mul(p).reshape<3>());
+            }
+            return ret;
+        }
+
+        // Conservative pixel bounds of world points, the whole target if any is behind the near plane
+        static ScreenRect project_bounds(const std::vector<Vector3f>& points, CameraComponent* camera)
+        {
+            Matrix4f V = camera->getV();
+            Matrix4f P = camera->getP();
+            Matrix4f view_port = camera->getViewPort();
+            float lo[2]{ FLT_MAX, FLT_MAX }, hi[2]{ -FLT_MAX, -FLT_MAX };
+            for (const auto& p : points)
+            {
+                Vector4f vs = V.mul(p.reshape<4>(1));
+                if (vs[2] < camera->get_near())
+                {
+                    return full_rect(camera); // clipping may put the triangle anywhere on the screen
+                }
+                Vector4f cs = P.mul(vs);
+                Vector4f ss = view_port.mul(cs / cs[3]);
+                for (int k = 0; k < 2; ++k)
+                {
+                    lo[k] = std::min(lo[k], ss[k]);
+                    hi[k] = std::max(hi[k], ss[k]);
+                }
+            }
+            // One pixel of slack for bbox rounding and the MSAA sample offsets
+            ScreenRect ret{ static_cast<int>(std::floor(lo[0])) - 1, static_cast<int>(std::floor(lo[1])) - 1, static_cast<int>(std::ceil(hi[0])) + 2, static_cast<int>(std::ceil(hi[1])) + 2 };
+            return ret.intersect(full_rect(camera));
+        }
+
+        // Pixel bounds of the mesh, for an instanced mesh of its instances visible to the camera
+        ScreenRect mesh_screen_bounds(MeshComponent* mesh, CameraComponent* camera)
+        {
+            const MeshData* data = mesh->get_mesh_data();
+            if (data == nullptr || data->vertex_count() == 0)
+            {
+                return {};
+            }
+            if (!mesh->is_instanced())
+            {
+                return project_bounds(box_corners(data->get_bounds_min(), data->get_bounds_max(), mesh->getM()), camera);
+            }
+            auto instanced = static_cast<InstancedMeshComponent*>(mesh);
+            ScreenRect ret;
+            for (uint32_t i : visible_instances_[camera][mesh].instances)
+            {
+                ret = ret.unite(project_bounds(box_corners(data->get_bounds_min(), data->get_bounds_max(), instanced->get_instance_world_matrix(i)), camera));
+            }
+            return ret;
+        }
+
+        // World space corners of the model box, or of the world box around all instances
+        static std::vector<Vector3f> mesh_box_corners(MeshComponent* mesh)
+        {
+            if (mesh->is_instanced())
+            {
+                const Bounds& bounds = mesh->get_world_bounds();
+                return box_corners(Vector3f{ bounds.min[0], bounds.min[1], bounds.min[2] }, Vector3f{ bounds.max[0], bounds.max[1], bounds.max[2] }, indentity<float, 4>());
+            }
+            const MeshData* data = mesh->get_mesh_data();
+            return box_corners(data->get_bounds_min(), data->get_bounds_max(), mesh->getM());
+        }
+
+        // Screen rect the mesh covers in this frame, empty if culled
+        ScreenRect mesh_bounds(const MeshComponent* mesh, const CameraComponent* camera)
+        {
+            auto record = mesh_records_.find(mesh);
+            if (record == mesh_records_.end())
+            {
+                return ScreenRect();
+            }
+            for (const MeshBounds& b : record->second.bounds)
+            {
+                if (b.camera == camera)
+                {
+                    return b.visible_frame == frame_ ? b.projected : ScreenRect();
+                }
+            }
+            return ScreenRect();
+        }
+
+        /* Screen area of `camera` whose shadowing may change because the shadow map of `light_camera`
+           was repainted inside `light_region`: for every receiver under a repainted light rect, the
+           world box of the light column over that rect, limited to the receiver's light depth range,
+           is intersected with the receiver's world box and projected. */
+        void add_shadow_damage(Region& damage, const std::vector<MeshComponent*>& meshes, CameraComponent* light_camera, const Region& light_region, CameraComponent* camera)
+        {
+            Matrix4f light_V = light_camera->getV();
+            for (MeshComponent* mesh : meshes)
+            {
+                const MeshData* data = mesh->get_mesh_data();
+                if (data == nullptr || !overlaps(light_region, mesh_bounds(mesh, light_camera)))
+                {
+                    continue;
+                }
+                std::vector<Vector3f> corners = mesh_box_corners(mesh);
+                Vector3f box_lo{ FLT_MAX, FLT_MAX, FLT_MAX }, box_hi{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+                float z_lo = FLT_MAX, z_hi = -FLT_MAX;
+                for (const auto& p : corners)
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        box_lo[k] = std::min(box_lo[k], p[k]);
+                        box_hi[k] = std::max(box_hi[k], p[k]);
+                    }
+                    float z = light_V.mul(p.reshape<4>(1))[2];
+                    z_lo = std::min(z_lo, z);
+                    z_hi = std::max(z_hi, z);
+                }
+                z_lo = std::max(z_lo, light_camera->get_near());
+                if (z_hi < z_lo)
+                {
+                    continue;
+                }
+                for (const auto& rect : light_region)
+                {
+                    ScreenRect r = rect.intersect(mesh_bounds(mesh, light_camera));
+                    if (r.empty())
+                    {
+                        continue;
+                    }
+                    Vector3f col_lo{ FLT_MAX, FLT_MAX, FLT_MAX }, col_hi{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+                    for (int c = 0; c < 8; ++c)
+                    {
+                        Vector3f p = light_camera->unproject(static_cast<float>(c & 1 ? r.x1 : r.x0), static_cast<float>(c & 2 ? r.y1 : r.y0), c & 4 ? z_hi : z_lo);
+                        for (int k = 0; k < 3; ++k)
+                        {
+                            col_lo[k] = std::min(col_lo[k], p[k]);
+                            col_hi[k] = std::max(col_hi[k], p[k]);
+                        }
+                    }
+                    Vector3f lo, hi;
+                    bool hit = true;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        lo[k] = std::max(col_lo[k], box_lo[k]);
+                        hi[k] = std::min(col_hi[k], box_hi[k]);
+                        hit = hit && lo[k] <= hi[k];
+                    }
+                    if (hit)
+                    {
+                        add_rect(damage, project_bounds(box_corners(lo, hi, indentity<float, 4>()), camera));
+                    }
+                }
+            }
+        }
+
         template <typename T>
         using Triangle = Tensor<T, 3>;
 
@@ -241,7 +578,8 @@ namespace Core
             return avg_viz;
         }
 
-        void Pass(const std::vector<MeshComponent*>& meshes, const std::vector<LightComponent*>& lights, const std::vector<CameraComponent*>& cameras, bool ZWrite = true, bool ZTest = true, bool ColorWrite = true)
+        // Blend accumulates color into the camera's transparency targets instead of writing it
+        void Pass(const std::vector<MeshComponent*>& meshes, const std::vector<LightComponent*>& lights, const std::vector<CameraComponent*>& cameras, bool ZWrite = true, bool ZTest = true, bool ColorWrite = true, bool Blend = false)
         {
             if (meshes.size() == 0 || lights.size() == 0 || cameras.size() == 0)
             {
@@ -249,141 +587,665 @@ namespace Core
             }
             for (CameraComponent* camera : cameras)
             {
-                // Buffer flush
-                camera->flush_buffer();
+                const Region& region = scissor_[camera];
+                if (region.empty())
+                {
+                    continue; // nothing changed in front of this camera
+                }
+
 
                 // Getting attributes
                 CameraAttribute ca; // object attributes
                 ca.V = camera->getV();
                 ca.P = camera->getP();
-                ca.camera_postion = camera->get_position();
+                ca.camera_postion = camera->get_world_position();
 
+                std::vector<LightAttribute> las; // light attributes
                 for (LightComponent* light : lights)
                 {
-                    // Getting attributes
-                    LightAttribute la; // light attributes
+                    LightAttribute la;
                     la.world_light_dir = light->get_light_dir();
                     la.light_color = light->get_light_color();
                     la.light_intensity = light->get_light_intensity();
                     la.specular_color = light->get_specular_color();
                     la.ambient = light->get_ambient_color();
+                    las.push_back(la);
+                }
+
+                for (size_t l = 0; l < las.size() && !(Blend && l > 0); ++l) // a blended fragment sums every light at once
+                {
+                    const LightAttribute& la = las[l];
 
                     for (MeshComponent* mesh : meshes)
                     {
                         // Getting attributes
                         MeshAttribute ma; // mesh attribute
                         ma.M = mesh->getM();
-                        ma.albedo = mesh->get_albedo_texture();
+                        ma.albedo = &mesh->get_albedo_texture();
                         ma.gloss = mesh->get_gloss();
+                        ma.opacity = mesh->get_opacity();
 
-                        const std::vector<VertexInput>& in_vertexes = mesh->get_all_vertexes();
-                        for (size_t i = 0; i < in_vertexes.size(); i += 3)
+                        const MeshData* mesh_data = mesh->get_mesh_data();
+                        if (mesh_data == nullptr || !overlaps(region, mesh_bounds(mesh, camera)))
                         {
-                            /* Pipline: vertex */
-                            Triangle<VertexOutput> vo3;
-                            for (int j = 0; j < 3; ++j)
+                            continue;
+                        }
+                        static const VisibleInstances single_instance{ { 0 }, {} };
+                        const VisibleInstances& visible = mesh->is_instanced() ? visible_instances_[camera][mesh] : single_instance;
+                        std::vector<VertexOutput> vos(mesh_data->vertex_count());
+                        std::vector<uint8_t> shaded(mesh_data->vertex_count());
+                        float tint[4];
+
+                        size_t lod = mesh->get_lod(camera->get_id());
+                        size_t group = 0;
+                        for (size_t n = 0; n < visible.instances.size(); ++n)
+                        {
+                            uint32_t instance = visible.instances[n];
+                            if (mesh->is_instanced())
                             {
-                                vo3[j] = PhongShader::vert(in_vertexes[i + j], ca, ma);
+                                while (visible.groups[group].end <= n)
+                                {
+                                    ++group;
+                                }
+                                lod = visible.groups[group].lod;
+                                auto instanced = static_cast<InstancedMeshComponent*>(mesh);
+                                ma.M = instanced->get_instance_world_matrix(instance);
+                                Vector4f instance_tint = instanced->get_instance_tint(instance);
+                                for (int k = 0; k < 4; ++k)
+                                {
+                                    tint[k] = instance_tint[k];
+                                }
+                                ma.tint = tint;
                             }
 
-                            // Homogeneous clipping
-                            std::vector<Triangle<VertexOutput>> clip_tris = homogeneous_clipping(std::vector<Triangle<VertexOutput>>{vo3}, 0);
+                            /* Pipline: vertex, once per vertex the selected LOD uses */
+                            std::fill(shaded.begin(), shaded.end(), 0);
 
-                            for (auto tri : clip_tris)
+                            const uint32_t* indices = mesh_data->indices(lod);
+                            for (size_t i = 0; i < mesh_data->triangle_count(lod) * 3; i += 3)
                             {
-                                // Perspective division
-                                Triangle<Vector4f> SS_pos3; // screen space postion of 3 points
-                                Matrix4f M_view_port = camera->getViewPort(Vector2i{ Settings::WIDTH, Settings::HEIGHT });
-                                for (int i = 0; i < 3; ++i)
+                                Triangle<VertexOutput> vo3;
+                                for (int j = 0; j < 3; ++j)
                                 {
-                                    SS_pos3[i] = M_view_port.mul(tri[i].CS_POSITION / tri[i].CS_POSITION[3]);
-                                }
-                                // Round down x and y of pts
-                                Triangle<Vector2f> xy3;
-                                for (int k = 0; k < 3; ++k) {
-                                    xy3[k][0] = SS_pos3[k][0];
-                                    xy3[k][1] = SS_pos3[k][1];
+                                    uint32_t index = indices[i + j];
+                                    if (!shaded[index])
+                                    {
+                                        vos[index] = PhongShader::vert(mesh_data->get_vertex(index), ca, ma);
+                                        shaded[index] = 1;
+                                    }
+                                    vo3[j] = vos[index];
                                 }
-                                // for (int k = 0; k < 3; ++k)
-                                // {
-                                //     xy3[k][0] = static_cast<int>(SS_pos3[k][0]);
-                                //     xy3[k][1] = static_cast<int>(SS_pos3[k][1]);
-                                // }
-                                // Compute bbox
-                                Vector2f bbox_min{ std::max(0.f, std::min({xy3[0][0], xy3[1][0], xy3[2][0]})), std::max(0.f, std::min({xy3[0][1], xy3[1][1], xy3[2][1]})) };
-                                Vector2f bbox_max{ std::min(Settings::WIDTH - 1.f, std::max({xy3[0][0], xy3[1][0], xy3[2][0]})), std::min(Settings::HEIGHT - 1.f, std::max({xy3[0][1], xy3[1][1], xy3[2][1]})) };
-                                Vector2i bbox_min_i{ static_cast<int>(std::round(bbox_min[0])),static_cast<int>(std::round(bbox_min[1])) };
-                                Vector2i bbox_max_i{ static_cast<int>(std::round(bbox_max[0])),static_cast<int>(std::round(bbox_max[1])) };
-                                // Padding color by barycentric coordinates
-                                for (int x = bbox_min_i[0]; x < bbox_max_i[0]; x++) {
-                                    for (int y = bbox_min_i[1]; y < bbox_max_i[1]; y++) {
-                                        Vector3f bc_screen;
-                                        float cover_rate = 0.f;
-                                        float tmp[2]{ -0.25f,0.25f };
-                                        // float tmp[2]{ 0.f,0.f };
-                                        for (int k = 0;k < 4;++k) {  // 4X MSAA
-                                            bc_screen = get_barycentric_by_vector(xy3, Vector2f{ x + tmp[k % 2],y + tmp[k / 2] });
-                                            if (bc_screen[0] < 0 || bc_screen[1] < 0 || bc_screen[2] < 0) {
+
+                                // Homogeneous clipping
+                                std::vector<Triangle<VertexOutput>> clip_tris = homogeneous_clipping(std::vector<Triangle<VertexOutput>>{vo3}, 0);
+
+                                for (auto tri : clip_tris)
+                                {
+                                    // Perspective division
+                                    Triangle<Vector4f> SS_pos3; // screen space postion of 3 points
+                                    Matrix4f M_view_port = camera->getViewPort();
+                                    for (int i = 0; i < 3; ++i)
+                                    {
+                                        SS_pos3[i] = M_view_port.mul(tri[i].CS_POSITION / tri[i].CS_POSITION[3]);
+                                    }
+                                    // Round down x and y of pts
+                                    Triangle<Vector2f> xy3;
+                                    for (int k = 0; k < 3; ++k) {
+                                        xy3[k][0] = SS_pos3[k][0];
+                                        xy3[k][1] = SS_pos3[k][1];
+                                    }
+                                    // for (int k = 0; k < 3; ++k)
+                                    // {
+                                    //     xy3[k][0] = static_cast<int>(SS_pos3[k][0]);
+                                    //     xy3[k][1] = static_cast<int>(SS_pos3[k][1]);
+                                    // }
+                                    // Compute bbox
+                                    Vector2f bbox_min{ std::max(0.f, std::min({xy3[0][0], xy3[1][0], xy3[2][0]})), std::max(0.f, std::min({xy3[0][1], xy3[1][1], xy3[2][1]})) };
+                                    Vector2f bbox_max{ std::min(camera->get_width() - 1.f, std::max({xy3[0][0], xy3[1][0], xy3[2][0]})), std::min(camera->get_height() - 1.f, std::max({xy3[0][1], xy3[1][1], xy3[2][1]})) };
+                                    Vector2i bbox_min_i{ static_cast<int>(std::round(bbox_min[0])),static_cast<int>(std::round(bbox_min[1])) };
+                                    Vector2i bbox_max_i{ static_cast<int>(std::round(bbox_max[0])),static_cast<int>(std::round(bbox_max[1])) };
+                                    // Padding color by barycentric coordinates, only where the region repaints
+                                    for (const ScreenRect& rect : region) {
+                                    ScreenRect scissor = rect.intersect({ bbox_min_i[0], bbox_min_i[1], bbox_max_i[0], bbox_max_i[1] });
+                                    for (int x = scissor.x0; x < scissor.x1; x++) {
+                                        for (int y = scissor.y0; y < scissor.y1; y++) {
+                                            Vector3f bc_screen;
+                                            float cover_rate = 0.f;
+                                            float tmp[2]{ -0.25f,0.25f };
+                                            // float tmp[2]{ 0.f,0.f };
+                                            for (int k = 0;k < 4;++k) {  // 4X MSAA
+                                                bc_screen = get_barycentric_by_vector(xy3, Vector2f{ x + tmp[k % 2],y + tmp[k / 2] });
+                                                if (bc_screen[0] < 0 || bc_screen[1] < 0 || bc_screen[2] < 0) {
+                                                    continue;
+                                                }
+                                                cover_rate += 0.25f;
+                                            }
+                                            if (cover_rate < 1e-10) {
                                                 continue;
                                             }
-                                            cover_rate += 0.25f;
-                                        }
-                                        if (cover_rate < 1e-10) {
-                                            continue;
-                                        }
-                                        bc_screen = get_barycentric_by_vector(xy3, Vector2f{ x + 0.f,y + 0.f });
-                                        // Depth interpolate and test
-                                        Vector3f bc_clip = { bc_screen[0] / tri[0].CS_POSITION[3], bc_screen[1] / tri[1].CS_POSITION[3], bc_screen[2] / tri[2].CS_POSITION[3] };
-                                        float Z_n = 1 / (bc_clip[0] + bc_clip[1] + bc_clip[2]);
-                                        if (ZTest) {
-                                            if (Z_n >= camera->get_depth_buffer().get(x, y)) {
+                                            bc_screen = get_barycentric_by_vector(xy3, Vector2f{ x + 0.f,y + 0.f });
+                                            // Depth interpolate and test
+                                            Vector3f bc_clip = { bc_screen[0] / tri[0].CS_POSITION[3], bc_screen[1] / tri[1].CS_POSITION[3], bc_screen[2] / tri[2].CS_POSITION[3] };
+                                            float Z_n = 1 / (bc_clip[0] + bc_clip[1] + bc_clip[2]);
+                                            if (ZTest) {
+                                                if (Z_n >= camera->get_depth(x, y)) {
+                                                    continue;
+                                                }
+                                            }
+                                            if (ZWrite) {
+                                                camera->set_depth_buffer(x, y, Z_n);
+                                            }
+                                            if (camera->type != CameraComponent::Type::ColorCamera) {
                                                 continue;
                                             }
-                                        }
-                                        if (ZWrite) {
-                                            camera->set_depth_buffer(x, y, Z_n);
-                                        }
-                                        if (camera->type != CameraComponent::Type::ColorCamera) {
-                                            continue;
-                                        }
-                                        // Color and Normal interpolate
-                                        VertexOutput interp_vo;
-                                        for (int i = 0; i < 3; ++i) {
-                                            interp_vo += bc_clip[i] * tri[i];
-                                        }
-                                        FragmentInput fi;
-                                        fi.I_UV = interp_vo.UV * Z_n;
-                                        fi.IWS_NORMAL = interp_vo.WS_NORMAL * Z_n;
-                                        fi.IWS_POSITION = interp_vo.WS_POSITION * Z_n;
-
-                                        /* Pipline: fragment */
-                                        Vector4c fo = PhongShader::frag(fi, la, ca, ma, cover_rate);
-                                        /* Visibility test for creating shadow */
-                                        float visibility = 0.f;
-                                        for (auto dp_camera : depth_cameras_) {
-                                            // visibility += HS(dp_camera->get_depth_buffer(), fi.IWS_POSITION, fi.IWS_NORMAL, dp_camera->get_lookat_dir(), dp_camera->getV(), dp_camera->getP(), dp_camera->getViewPort(Vector2i{Settings::WIDTH, Settings::HEIGHT}));
-                                            // visibility += PCF(dp_camera->get_depth_buffer(), fi.IWS_POSITION, fi.IWS_NORMAL, dp_camera->get_lookat_dir(), dp_camera->getV(), dp_camera->getP(), dp_camera->getViewPort(Vector2i{Settings::WIDTH, Settings::HEIGHT}));
-                                            visibility += PCSS(dp_camera->get_depth_buffer(), fi.IWS_POSITION, fi.IWS_NORMAL, dp_camera->get_lookat_dir(), dp_camera->getV(), dp_camera->getP(), dp_camera->getViewPort(Vector2i{ Settings::WIDTH, Settings::HEIGHT }));
-                                        }
-                                        // fo *= visibility;
-                                        // fo *= cover_rate;
-                                        if (ColorWrite) {
-                                            camera->set_color_buffer(x, y, fo);
+                                            // Color and Normal interpolate
+                                            VertexOutput interp_vo;
+                                            for (int i = 0; i < 3; ++i) {
+                                                interp_vo += bc_clip[i] * tri[i];
+                                            }
+                                            FragmentInput fi;
+                                            fi.I_UV = interp_vo.UV * Z_n;
+                                            fi.IWS_NORMAL = interp_vo.WS_NORMAL * Z_n;
+                                            fi.IWS_POSITION = interp_vo.WS_POSITION * Z_n;
+
+                                            /* Pipline: fragment */
+                                            RGBA8 fo = Blend ? PhongShader::frag(fi, las, ca, ma) : PhongShader::frag(fi, la, ca, ma, cover_rate);
+                                            /* Visibility test for creating shadow */
+                                            float visibility = 0.f;
+                                            for (auto dp_camera : depth_cameras_) {
+                                                // visibility += HS(dp_camera->get_depth_buffer(), fi.IWS_POSITION, fi.IWS_NORMAL, dp_camera->get_lookat_dir(), dp_camera->getV(), dp_camera->getP(), dp_camera->getViewPort());
+                                                // visibility += PCF(dp_camera->get_depth_buffer(), fi.IWS_POSITION, fi.IWS_NORMAL, dp_camera->get_lookat_dir(), dp_camera->getV(), dp_camera->getP(), dp_camera->getViewPort());
+                                                visibility += PCSS(dp_camera->get_depth_buffer(), fi.IWS_POSITION, fi.IWS_NORMAL, dp_camera->get_lookat_dir(), dp_camera->getV(), dp_camera->getP(), dp_camera->getViewPort());
+                                            }
+                                            // fo *= visibility;
+                                            // fo *= cover_rate;
+                                            if (ColorWrite && Blend) {
+                                                camera->accumulate_transparent(x, y, fo, fo[3] / 255.f * cover_rate, Z_n);
+                                            }
+                                            else if (ColorWrite) {
+                                                camera->set_color_buffer(x, y, fo);
+                                            }
                                         }
                                     }
-                                }
-                            } // end for trianle
-                        }     // end for vertex
+                                    } // end for rect
+                                } // end for trianle
+                            }     // end for vertex
+                        }     // end for instance
                     }         // end for mesh
                 }             // end for light
             }                 // end for camera
         }
 
+        /* Frustum culling through the scene's BVH: whole subtrees outside the view are rejected
+           without visiting their meshes, the bounding sphere then rejects some of the rest. */
+        const std::vector<MeshComponent*>& cull(CameraComponent* camera)
+        {
+            Frustum frustum(camera->getVP());
+            std::vector<MeshComponent*>& visible = visible_[camera];
+            visible.clear();
+            current_scene->query_meshes(frustum, [&](MeshComponent* mesh)
+            {
+                if (frustum.test(mesh->get_world_bounds()) != Frustum::Outside)
+                {
+                    visible.push_back(mesh);
+                }
+            });
+            CullCount& count = cull_counts_[camera];
+            count.visible = static_cast<int>(visible.size());
+            count.culled = static_cast<int>(current_scene->indexed_mesh_count() - visible.size());
+            return visible;
+        }
+
+        /* Occlusion culling after frustum culling: the chosen occluders are rasterized into a low
+           resolution depth buffer and the visible meshes entirely behind them are dropped. The
+           buffer is reused when the camera and its occluders did not change since the last frame,
+           or when another camera already drew the same occluders from the same viewpoint. */
+        void occlusion_cull(CameraComponent* camera)
+        {
+            std::vector<MeshComponent*>& visible = visible_[camera];
+            ScreenRect screen = full_rect(camera);
+            std::vector<std::pair<long long, MeshComponent*>> candidates;
+            for (auto mesh : visible)
+            {
+                if (mesh->type != MeshComponent::Type::Opaque || mesh->get_occluder() == MeshComponent::NeverOccluder || mesh->is_instanced())
+                {
+                    continue;
+                }
+                long long area = mesh_screen_bounds(mesh, camera).intersect(screen).area();
+                if (mesh->get_occluder() == MeshComponent::AlwaysOccluder)
+                {
+                    candidates.push_back({ LLONG_MAX, mesh });
+                }
+                else if (mesh->get_mesh_data()->triangle_count() <= OCCLUDER_MAX_TRIANGLES && area >= screen.area() * OCCLUDER_MIN_SCREEN_FRACTION)
+                {
+                    candidates.push_back({ area, mesh });
+                }
+            }
+            if (candidates.empty())
+            {
+                return;
+            }
+            std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b)
+            {
+                return a.first > b.first;
+            });
+            candidates.resize(std::min(candidates.size(), MAX_OCCLUDERS));
+
+            std::vector<uint64_t> signature;
+            for (const auto& candidate : candidates)
+            {
+                signature.push_back(reinterpret_cast<uintptr_t>(candidate.second));
+                signature.push_back(candidate.second->get_version());
+            }
+            Matrix4f VP = camera->getVP();
+            const OcclusionBuffer* buffer = nullptr;
+            for (const auto& used : occlusion_used_)
+            {
+                if (used.second->matches(VP, camera->get_near(), signature))
+                {
+                    buffer = used.second;
+                    break;
+                }
+            }
+            OcclusionBuffer& own = occlusion_buffers_[camera];
+            if (buffer == nullptr && own.matches(VP, camera->get_near(), signature))
+            {
+                buffer = &own;
+            }
+            if (buffer == nullptr)
+            {
+                own.begin(VP, camera->get_near(), std::move(signature));
+                for (const auto& candidate : candidates)
+                {
+                    const MeshData* data = candidate.second->get_mesh_data();
+                    own.rasterize(data->positions(), data->vertex_count(), data->indices(), data->triangle_count(), candidate.second->getM());
+                }
+                buffer = &own;
+            }
+            occlusion_used_[camera] = buffer;
+
+            CullCount& count = cull_counts_[camera];
+            auto occluded = [&](MeshComponent* mesh)
+            {
+                for (const auto& candidate : candidates)
+                {
+                    if (candidate.second == mesh)
+                    {
+                        return false;
+                    }
+                }
+                return buffer->occluded(mesh->get_world_bounds());
+            };
+            auto end = std::remove_if(visible.begin(), visible.end(), occluded);
+            count.occluded = static_cast<int>(visible.end() - end);
+            count.visible -= count.occluded;
+            visible.erase(end, visible.end());
+        }
+
+        /* Instances of the visible instanced meshes are culled one by one against the frustum
+           and the camera's occlusion buffer; a mesh left without instances is dropped. */
+        void cull_instances(CameraComponent* camera)
+        {
+            Frustum frustum(camera->getVP());
+            auto used = occlusion_used_.find(camera);
+            const OcclusionBuffer* buffer = used != occlusion_used_.end() ? used->second : nullptr;
+            std::vector<MeshComponent*>& visible = visible_[camera];
+            auto& lists = visible_instances_[camera];
+            CullCount& count = cull_counts_[camera];
+            auto culled = [&](MeshComponent* mesh)
+            {
+                if (!mesh->is_instanced())
+                {
+                    return false;
+                }
+                auto instanced = static_cast<InstancedMeshComponent*>(mesh);
+                std::vector<uint32_t>& list = lists[mesh].instances;
+                for (size_t i = 0; i < instanced->instance_count(); ++i)
+                {
+                    Bounds bounds = instanced->get_instance_world_bounds(i);
+                    if (frustum.test(bounds) == Frustum::Outside || (buffer != nullptr && buffer->occluded(bounds)))
+                    {
+                        ++count.culled_instances;
+                        continue;
+                    }
+                    list.push_back(static_cast<uint32_t>(i));
+                }
+                count.instances += static_cast<int>(list.size());
+                return list.empty();
+            };
+            auto end = std::remove_if(visible.begin(), visible.end(), culled);
+            count.culled += static_cast<int>(visible.end() - end);
+            count.visible -= static_cast<int>(visible.end() - end);
+            visible.erase(end, visible.end());
+        }
+
+        // Projected radius in pixels of a bounding sphere, FLT_MAX when it reaches the near plane
+        static float radius_pixels(const Bounds& bounds, const Matrix4f& V, float pixels_per_unit, float near)
+        {
+            float depth = V[2][0] * bounds.center[0] + V[2][1] * bounds.center[1] + V[2][2] * bounds.center[2] + V[2][3];
+            return depth - bounds.radius > near ? bounds.radius * pixels_per_unit / depth : FLT_MAX;
+        }
+
+        /* LOD of every visible mesh from its bounding sphere's projected radius, of every visible
+           instance for instanced meshes, whose instance lists are then grouped by LOD. */
+        void select_lods(CameraComponent* camera)
+        {
+            const Matrix4f& V = camera->getV();
+            float pixels_per_unit = camera->getP()[1][1] * camera->get_height() / 2; // at view depth 1
+            CullCount& count = cull_counts_[camera];
+            for (auto mesh : visible_[camera])
+            {
+                const MeshData* data = mesh->get_mesh_data();
+                if (!mesh->is_instanced())
+                {
+                    float radius = radius_pixels(mesh->get_world_bounds(), V, pixels_per_unit, camera->get_near());
+                    count.triangles += data->triangle_count(mesh->select_lod(camera->get_id(), radius));
+                    continue;
+                }
+                auto instanced = static_cast<InstancedMeshComponent*>(mesh);
+                VisibleInstances& visible = visible_instances_[camera][mesh];
+                std::vector<uint32_t> by_lod[MAX_MESH_LODS];
+                for (uint32_t i : visible.instances)
+                {
+                    float radius = radius_pixels(instanced->get_instance_world_bounds(i), V, pixels_per_unit, camera->get_near());
+                    size_t lod = instanced->select_instance_lod(camera->get_id(), i, radius);
+                    by_lod[lod].push_back(i);
+                    count.triangles += data->triangle_count(lod);
+                }
+                visible.instances.clear();
+                visible.groups.clear();
+                for (size_t lod = 0; lod < MAX_MESH_LODS; ++lod)
+                {
+                    if (!by_lod[lod].empty())
+                    {
+                        visible.instances.insert(visible.instances.end(), by_lod[lod].begin(), by_lod[lod].end());
+                        visible.groups.push_back({ lod, visible.instances.size() });
+                    }
+                }
+            }
+        }
+
+        /* One command per visible mesh, keyed by the camera's pass, the mesh's layer and material
+           and the view depth of its origin. Large visible sets are split into chunks recorded in
+           parallel, the queue merges them in chunk order so the result doesn't depend on timing. */
+        void record_commands(CameraComponent* camera)
+        {
+            const std::vector<MeshComponent*>& visible = visible_[camera];
+            RenderQueue<MeshComponent*>& queue = queues_[camera];
+            size_t recorders = visible.size() >= PARALLEL_RECORD_MIN ? static_cast<size_t>(record_pool().size()) : 1;
+            queue.begin(recorders);
+
+            const Matrix4f& V = camera->getV();
+            float near = camera->get_near(), depth_range = camera->get_far() - camera->get_near();
+            SortKey::Pass pass = camera->type == CameraComponent::Type::ColorCamera ? SortKey::ColorPass : SortKey::ShadowPass;
+            auto record = [&](size_t r)
+            {
+                std::vector<RenderQueue<MeshComponent*>::Command>& list = queue.recorder(r);
+                size_t begin = visible.size() * r / recorders, end = visible.size() * (r + 1) / recorders;
+                list.reserve(end - begin);
+                for (size_t i = begin; i < end; ++i)
+                {
+                    MeshComponent* mesh = visible[i];
+                    const Matrix4f& M = mesh->getM();
+                    float z = V[2][0] * M[0][3] + V[2][1] * M[1][3] + V[2][2] * M[2][3] + V[2][3];
+                    SortKey::Layer layer = mesh->type == MeshComponent::Type::Opaque ? SortKey::OpaqueLayer : SortKey::TransparentLayer;
+                    list.push_back({ SortKey::make(pass, layer, mesh->get_material_key(), (z - near) / depth_range), mesh });
+                }
+            };
+            if (recorders == 1)
+            {
+                record(0);
+            }
+            else
+            {
+                std::vector<std::future<void>> done;
+                for (size_t r = 0; r < recorders; ++r)
+                {
+                    done.push_back(record_pool().submit([&record, r]()
+                    {
+                        record(r);
+                    }));
+                }
+                for (auto& f : done)
+                {
+                    f.get();
+                }
+            }
+            queue.sort();
+        }
+
+        /* Run the camera's sorted commands, one Pass per pass and layer. A color camera blends its
+           transparent layer without writing depth and composites it over the opaque color at the
+           end, in the repainted region only. */
+        void draw_queue(CameraComponent* camera, const std::vector<LightComponent*>& lights)
+        {
+            const auto& commands = queues_[camera].commands();
+            std::vector<MeshComponent*> run;
+            bool blended = false;
+            for (size_t i = 0; i < commands.size(); ++i)
+            {
+                run.push_back(commands[i].item);
+                if (i + 1 == commands.size() || commands[i + 1].key >> SortKey::LAYER_SHIFT != commands[i].key >> SortKey::LAYER_SHIFT)
+                {
+                    bool blend = camera->type == CameraComponent::Type::ColorCamera && SortKey::layer(commands[i].key) == SortKey::TransparentLayer;
+                    Pass(run, lights, { camera }, !blend, true, true, blend);
+                    blended = blended || blend;
+                    run.clear();
+                }
+            }
+            if (blended)
+            {
+                for (const ScreenRect& rect : scissor_[camera])
+                {
+                    camera->resolve_transparency(rect.x0, rect.y0, rect.x1, rect.y1);
+                }
+            }
+        }
+
+        /* Decide what every camera repaints this frame and clear exactly that. A target that is
+           `age` frames old also repaints the damage of the age - 1 frames it missed; without that
+           history (or after a camera, light or scene change) the whole target is repainted. */
+        void plan_frame(const std::vector<MeshComponent*>& meshes, const std::vector<LightComponent*>& lights, const std::vector<CameraComponent*>& depth_cameras, const std::vector<CameraComponent*>& color_cameras)
+        {
+            std::vector<CameraComponent*> cameras = depth_cameras; // shadow maps first, color cameras need their damage
+            cameras.insert(cameras.end(), color_cameras.begin(), color_cameras.end());
+
+            std::vector<uint64_t> signature{ current_scene->get_mesh_generation() };
+            for (auto camera : cameras)
+            {
+                signature.push_back(reinterpret_cast<uintptr_t>(camera));
+            }
+            size_t members = signature.size(); // mesh generation and cameras, lights follow
+            for (auto light : lights)
+            {
+                signature.push_back(reinterpret_cast<uintptr_t>(light));
+                signature.push_back(light->get_version());
+            }
+            bool members_changed = scene_signature_.size() < members || !std::equal(signature.begin(), signature.begin() + members, scene_signature_.begin());
+            bool scene_changed = !incremental_ || signature != scene_signature_;
+            scene_signature_ = std::move(signature);
+
+            ++frame_;
+            if (members_changed)
+            {
+                for (auto mesh : meshes)
+                {
+                    mesh_records_[mesh].seen_frame = frame_;
+                }
+                for (auto iter = mesh_records_.begin(); iter != mesh_records_.end();)
+                {
+                    if (iter->second.seen_frame != frame_)
+                    {
+                        iter = mesh_records_.erase(iter);
+                        continue;
+                    }
+                    auto& bounds = iter->second.bounds; // forget removed cameras, a new one may take the address
+                    bounds.erase(std::remove_if(bounds.begin(), bounds.end(), [&](const MeshBounds& b)
+                    {
+                        return std::find(cameras.begin(), cameras.end(), b.camera) == cameras.end();
+                    }), bounds.end());
+                    ++iter;
+                }
+            }
+
+            // Covered rects of the last frame, before this frame's visibility replaces them. Only
+            // touched meshes can have changed, all of them are looked at when the members changed.
+            std::vector<MeshComponent*> changed_meshes;
+            std::vector<std::vector<ScreenRect>> changed_old; // per changed mesh and camera
+            auto note_change = [&](MeshComponent* mesh)
+            {
+                MeshRecord& record = mesh_records_[mesh]; // only new meshes allocate, and change the generation
+                if ((record.version == mesh->get_version() && !record.bounds.empty()) || record.changed_frame == frame_)
+                {
+                    return;
+                }
+                record.changed_frame = frame_;
+                changed_meshes.push_back(mesh);
+                changed_old.emplace_back();
+                for (auto camera : cameras)
+                {
+                    bool seen = std::any_of(record.bounds.begin(), record.bounds.end(), [camera](const MeshBounds& b)
+                    {
+                        return b.camera == camera;
+                    });
+                    const MeshBounds& b = record.of(camera);
+                    changed_old.back().push_back(!seen ? full_rect(camera) : b.visible_frame == frame_ - 1 ? b.projected : ScreenRect());
+                }
+            };
+            if (members_changed)
+            {
+                for (auto mesh : meshes)
+                {
+                    note_change(mesh);
+                }
+            }
+            else
+            {
+                current_scene->visit_touched_meshes(note_change);
+            }
+            for (auto camera : cameras)
+            {
+                for (auto mesh : visible_[camera])
+                {
+                    MeshBounds& b = mesh_records_[mesh].of(camera);
+                    if (b.mesh_version != mesh->get_version() || b.camera_version != camera->get_version() || b.visible_frame == 0)
+                    {
+                        b.projected = mesh_screen_bounds(mesh, camera);
+                        b.mesh_version = mesh->get_version();
+                        b.camera_version = camera->get_version();
+                    }
+                    b.visible_frame = frame_;
+                }
+            }
+
+            std::unordered_map<const CameraComponent*, Region> light_damage; // shadow map texels that changed
+            bool light_full = false;
+            if (scene_changed)
+            {
+                scissor_.clear(); // of removed cameras
+            }
+            for (size_t c = 0; c < cameras.size(); ++c)
+            {
+                CameraComponent* camera = cameras[c];
+                CameraRecord& record = camera_records_[camera];
+                ScreenRect screen = full_rect(camera);
+                bool content_full = scene_changed || record.version != camera->get_version();
+                Region damage;
+                if (!content_full && camera->type == CameraComponent::Type::ColorCamera)
+                {
+                    content_full = light_full;
+                }
+                for (size_t i = 0; !content_full && i < changed_meshes.size(); ++i)
+                {
+                    add_rect(damage, changed_old[i][c]);
+                    add_rect(damage, mesh_bounds(changed_meshes[i], camera));
+                }
+                if (!content_full && camera->type == CameraComponent::Type::ColorCamera)
+                {
+                    for (auto depth_camera : depth_cameras)
+                    {
+                        const Region& light_region = light_damage[depth_camera];
+                        if (!light_region.empty()) // a still shadow map shadows nothing new
+                        {
+                            add_shadow_damage(damage, meshes, depth_camera, light_region, camera);
+                        }
+                    }
+                }
+                if (content_full)
+                {
+                    damage = Region{ screen };
+                }
+                if (camera->type == CameraComponent::Type::DepthCamera)
+                {
+                    light_full = light_full || content_full;
+                    light_damage[camera] = damage;
+                }
+
+                int age = camera->get_target_age();
+                bool full = content_full || age == 0 || static_cast<int>(record.damage.size()) < age - 1;
+                Region repaint = full ? Region{ screen } : damage;
+                for (int i = 0; !full && i < age - 1; ++i)
+                {
+                    for (const auto& rect : record.damage[i])
+                    {
+                        add_rect(repaint, rect);
+                    }
+                }
+                record.version = camera->get_version();
+                record.damage.push_front(damage);
+                while (record.damage.size() > static_cast<size_t>(std::max(camera->get_target_count(), 1)))
+                {
+                    record.damage.pop_back();
+                }
+
+                if (full)
+                {
+                    camera->flush_buffer();
+                }
+                else
+                {
+                    for (const auto& rect : repaint)
+                    {
+                        camera->clear_rect(rect.x0, rect.y0, rect.x1, rect.y1);
+                    }
+                }
+                if (camera->type == CameraComponent::Type::ColorCamera)
+                {
+                    long long pixels = 0;
+                    for (const auto& rect : repaint)
+                    {
+                        pixels += rect.area();
+                    }
+                    Stats::record("repaint_fraction", static_cast<double>(pixels) / std::max(screen.area(), 1LL));
+                }
+                scissor_[camera] = std::move(repaint);
+            }
+
+            for (auto mesh : changed_meshes)
+            {
+                mesh_records_[mesh].version = mesh->get_version();
+            }
+        }
+
     public:
         RasterizeSystem() : System(this)
         {
         }
 
+        // Incremental frames only repaint what changed since the target was last rendered (default on)
+        RasterizeSystem* set_incremental(bool incremental)
+        {
+            incremental_ = incremental;
+            return this;
+        }
+
+        // Skip meshes hidden behind large occluders (default on)
+        RasterizeSystem* set_occlusion_culling(bool occlusion_culling)
+        {
+            occlusion_culling_ = occlusion_culling;
+            return this;
+        }
+
         void update()
         {
             // std::vector<Vector2f> rd_samples = Utils::RandomSample::poissonDiskSamples();
@@ -399,9 +1261,11 @@ namespace Core
             // }
             // return;
 
-            auto cameras = current_scene->get_all_components<CameraComponent>();
-            decltype(cameras) color_cameras;
-            decltype(cameras) depth_cameras;
+            current_scene->update_transforms();
+
+            const auto& cameras = current_scene->get_all_components<CameraComponent>();
+            std::vector<CameraComponent*> color_cameras;
+            std::vector<CameraComponent*> depth_cameras;
             for (auto camera : cameras)
             {
                 switch (camera->type)
@@ -413,58 +1277,61 @@ namespace Core
                     depth_cameras.push_back(camera);
                     break;
                 default:
-                    throw std::exception("Unknown camera type!\n");
+                    throw std::runtime_error("Unknown camera type!\n");
                     break;
                 }
             }
             assert(color_cameras.size() == 1);
 
-            auto meshes = current_scene->get_all_components<MeshComponent>();
-            decltype(meshes) opaque_meshes;
-            decltype(meshes) transparent_meshes;
-            for (auto mesh : meshes)
+            // Also polls loads in flight, a mesh or texture that finished bumps its version
+            const std::vector<MeshComponent*>& meshes = current_scene->get_all_meshes();
+            current_scene->update_spatial_index();
+            cull_counts_.clear();
+            visible_.clear();
+            visible_instances_.clear();
+            occlusion_used_.clear();
+            for (auto camera : cameras)
             {
-                switch (mesh->type)
+                camera->acquire_target();
+                cull(camera);
+                if (occlusion_culling_)
                 {
-                case MeshComponent::Type::Opaque:
-                    opaque_meshes.push_back(mesh);
-                    break;
-                case MeshComponent::Type::Transparent:
-                    transparent_meshes.push_back(mesh);
-                    break;
-                default:
-                    throw std::exception("Unknown mesh type!\n");
-                    break;
+                    occlusion_cull(camera);
                 }
+                cull_instances(camera);
+                select_lods(camera);
             }
+            const auto& lights = current_scene->get_all_components<LightComponent>();
+            plan_frame(meshes, lights, depth_cameras, color_cameras);
 
-            // Sort by view space distance
-            auto increase_cmp_func = [](const MeshComponent* comp1, const MeshComponent* comp2) -> bool
+            // Shadow maps first, the color cameras sample them
+            for (auto camera : cameras)
             {
-                return (*comp1).Z_view < (*comp2).Z_view;
-            };
-            auto decrease_cmp_func = [](const MeshComponent* comp1, const MeshComponent* comp2) -> bool
+                record_commands(camera);
+            }
+            for (auto depth_camera : depth_cameras)
             {
-                return (*comp1).Z_view > (*comp2).Z_view;
-            };
+                draw_queue(depth_camera, lights);
+            }
+            depth_cameras_ = depth_cameras;
             for (auto color_camera : color_cameras)
             {
-                for (auto mesh : meshes)
-                {
-                    mesh->Z_view = color_camera->getV().mul(mesh->get_position().reshape<4>(1))[2];
-                }
-                std::sort(opaque_meshes.begin(), opaque_meshes.end(), increase_cmp_func);
-                std::sort(transparent_meshes.begin(), transparent_meshes.end(), decrease_cmp_func);
+                draw_queue(color_camera, lights);
             }
 
-            // Depth camera render
-            auto lights = current_scene->get_all_components<LightComponent>();
-            Pass(meshes, lights, depth_cameras);
-            depth_cameras_ = depth_cameras;
-
-            // Color camera render
-            Pass(opaque_meshes, lights, color_cameras);
-            Pass(transparent_meshes, lights, color_cameras);
+            // Mesh counts per camera as "color0.visible_meshes", "shadow0.culled_meshes", ...
+            for (size_t i = 0; i < cameras.size(); ++i)
+            {
+                auto& group = cameras[i]->type == CameraComponent::Type::ColorCamera ? color_cameras : depth_cameras;
+                std::string label = (cameras[i]->type == CameraComponent::Type::ColorCamera ? "color" : "shadow") + std::to_string(std::find(group.begin(), group.end(), cameras[i]) - group.begin());
+                const CullCount& count = cull_counts_[cameras[i]];
+                Stats::record(label + ".visible_meshes", count.visible);
+                Stats::record(label + ".culled_meshes", count.culled);
+                Stats::record(label + ".occluded_meshes", count.occluded);
+                Stats::record(label + ".triangles", static_cast<double>(count.triangles));
+                Stats::record(label + ".visible_instances", count.instances);
+                Stats::record(label + ".culled_instances", count.culled_instances);
+            }
         }
     };
 
@@ -478,12 +1345,17 @@ namespace Core
 
         void update()
         {
-            // Test
-            std::cout << Time::get_delta_time() << std::endl;
             double w = 0.5;
             static double theta = 0;
             theta += w * Time::get_delta_time();
-            get_entity("TestObj")->get_component<MeshComponent>()->set_rotation(Vector3f{ static_cast<float>(std::cos(theta)), 0, static_cast<float>(std::sin(theta)) }, Vector3f{ 0, 1, 0 });
+            static const NameId test_obj = Names::intern("TestObj");
+            Entity *entity = get_entity_by_name(test_obj);
+            MeshComponent *mesh = entity != nullptr ? entity->get_component<MeshComponent>() : nullptr;
+            if (mesh == nullptr)
+            {
+                return; // nothing to animate in this scene
+            }
+            mesh->set_rotation(Vector3f{ static_cast<float>(std::cos(theta)), 0, static_cast<float>(std::sin(theta)) }, Vector3f{ 0, 1, 0 });
         }
     };
 }
@@ -5,32 +5,50 @@
 
 namespace Core
 {
+    // Frame timing: begin_frame() and end_frame() bracket the systems' update of every frame
     class Time
     {
     private:
-        static std::chrono::system_clock::time_point current_frame_time_;
-        static std::chrono::system_clock::time_point last_frame_time_;
+        static std::chrono::system_clock::time_point frame_start_time_;
+        static bool started_;
+        static double delta_time_;
+        static double frame_cost_;
+
+        static double seconds(std::chrono::system_clock::duration d)
+        {
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(d);
+            return static_cast<double>(duration.count()) * std::chrono::microseconds::period::num / std::chrono::microseconds::period::den;
+        }
 
     public:
-        static void clock()
+        static void begin_frame()
         {
-            current_frame_time_ = std::chrono::system_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(current_frame_time_ - last_frame_time_);
-            std::cout << "Cost : "
-                      << double(duration.count()) * std::chrono::microseconds::period::num / std::chrono::microseconds::period::den
-                      << " s" << std::endl;
-            last_frame_time_ = current_frame_time_;
+            auto now = std::chrono::system_clock::now();
+            delta_time_ = started_ ? seconds(now - frame_start_time_) : 0.; // the first frame has nothing to advance from
+            frame_start_time_ = now;
+            started_ = true;
         }
-        // Return delta time (s) between two frames
+        static void end_frame()
+        {
+            frame_cost_ = seconds(std::chrono::system_clock::now() - frame_start_time_);
+            std::cout << "Cost : " << frame_cost_ << " s" << std::endl;
+        }
+        // Return delta time (s) between the starts of the last two frames, what animation advances by
         static double get_delta_time()
         {
-            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(current_frame_time_ - last_frame_time_);
-            return static_cast<double>(duration.count()) * std::chrono::microseconds::period::num / std::chrono::microseconds::period::den;
+            return delta_time_;
+        }
+        // Return the time (s) the last finished frame spent between begin_frame and end_frame
+        static double get_frame_cost()
+        {
+            return frame_cost_;
         }
     };
 
-    std::chrono::system_clock::time_point Time::current_frame_time_ = std::chrono::system_clock::now();
-    std::chrono::system_clock::time_point Time::last_frame_time_ = std::chrono::system_clock::now();
+    std::chrono::system_clock::time_point Time::frame_start_time_ = std::chrono::system_clock::now();
+    bool Time::started_ = false;
+    double Time::delta_time_ = 0.;
+    double Time::frame_cost_ = 0.;
 }
 
 #endif // ERER_CORE_TIME_H_
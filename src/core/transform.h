@@ -0,0 +1,125 @@
+#ifndef ERER_CORE_TRANSFORM_H_
+#define ERER_CORE_TRANSFORM_H_
+
+#include <cmath>
+#include <iostream>
+
+#include "data_structure.hpp"
+
+namespace Core
+{
+    // Unit quaternion for rotations, four floats instead of a 4x4 matrix
+    struct Quaternion
+    {
+        float x = 0.f, y = 0.f, z = 0.f, w = 1.f;
+
+        static Quaternion from_axis_angle(const Vector3f &axis, float radians)
+        {
+            Vector3f a = axis.normal();
+            float s = std::sin(radians / 2);
+            return Quaternion{a[0] * s, a[1] * s, a[2] * s, std::cos(radians / 2)}.normalized();
+        }
+
+        // Rotation taking the x, y and z axes to the columns of an orthonormal right-handed basis
+        static Quaternion from_basis(const Vector3f &bx, const Vector3f &by, const Vector3f &bz)
+        {
+            float m00 = bx[0], m11 = by[1], m22 = bz[2];
+            float trace = m00 + m11 + m22;
+            Quaternion q;
+            if (trace > 0)
+            {
+                float s = std::sqrt(trace + 1.f) * 2; // 4w
+                q = {(by[2] - bz[1]) / s, (bz[0] - bx[2]) / s, (bx[1] - by[0]) / s, s / 4};
+            }
+            else if (m00 > m11 && m00 > m22)
+            {
+                float s = std::sqrt(1.f + m00 - m11 - m22) * 2; // 4x
+                q = {s / 4, (by[0] + bx[1]) / s, (bz[0] + bx[2]) / s, (by[2] - bz[1]) / s};
+            }
+            else if (m11 > m22)
+            {
+                float s = std::sqrt(1.f + m11 - m00 - m22) * 2; // 4y
+                q = {(by[0] + bx[1]) / s, s / 4, (bz[1] + by[2]) / s, (bz[0] - bx[2]) / s};
+            }
+            else
+            {
+                float s = std::sqrt(1.f + m22 - m00 - m11) * 2; // 4z
+                q = {(bz[0] + bx[2]) / s, (bz[1] + by[2]) / s, s / 4, (bx[1] - by[0]) / s};
+            }
+            return q.normalized();
+        }
+
+        Quaternion normalized() const
+        {
+            float n = std::sqrt(x * x + y * y + z * z + w * w);
+            if (n == 0.f)
+            {
+                return Quaternion();
+            }
+            return Quaternion{x / n, y / n, z / n, w / n};
+        }
+
+        // Hamilton product, applies other first
+        Quaternion operator*(const Quaternion &other) const
+        {
+            return Quaternion{w * other.x + x * other.w + y * other.z - z * other.y,
+                              w * other.y - x * other.z + y * other.w + z * other.x,
+                              w * other.z + x * other.y - y * other.x + z * other.w,
+                              w * other.w - x * other.x - y * other.y - z * other.z};
+        }
+
+        // Row-major 3x3 rotation matrix
+        void to_matrix(float m[3][3]) const
+        {
+            m[0][0] = 1 - 2 * (y * y + z * z);
+            m[0][1] = 2 * (x * y - z * w);
+            m[0][2] = 2 * (x * z + y * w);
+            m[1][0] = 2 * (x * y + z * w);
+            m[1][1] = 1 - 2 * (x * x + z * z);
+            m[1][2] = 2 * (y * z - x * w);
+            m[2][0] = 2 * (x * z - y * w);
+            m[2][1] = 2 * (y * z + x * w);
+            m[2][2] = 1 - 2 * (x * x + y * y);
+        }
+    };
+
+    // Inverse of a matrix whose last row is (0, 0, 0, 1), e.g. any product of TRS matrices
+    inline Matrix4f affine_inverse(const Matrix4f &m)
+    {
+        float a[3][3];
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                a[i][j] = m[i][j];
+            }
+        }
+        float c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+        float c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+        float c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+        float det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+        if (std::abs(det) < 1e-20f)
+        {
+            std::cerr << "Singular transform, scale must not be 0" << std::endl;
+            return indentity<float, 4>();
+        }
+        float inv[3][3] = {{c00, a[0][2] * a[2][1] - a[0][1] * a[2][2], a[0][1] * a[1][2] - a[0][2] * a[1][1]},
+                           {c01, a[0][0] * a[2][2] - a[0][2] * a[2][0], a[0][2] * a[1][0] - a[0][0] * a[1][2]},
+                           {c02, a[0][1] * a[2][0] - a[0][0] * a[2][1], a[0][0] * a[1][1] - a[0][1] * a[1][0]}};
+        Matrix4f ret = indentity<float, 4>();
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                ret[i][j] = inv[i][j] / det;
+            }
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            ret[i][3] = -(ret[i][0] * m[0][3] + ret[i][1] * m[1][3] + ret[i][2] * m[2][3]);
+        }
+        return ret;
+    }
+}
+
+#endif // ERER_CORE_TRANSFORM_H_
@@ -0,0 +1,213 @@
+// Offline renderer without a window: builds the default scene, renders N frames along an orbit
+// around the origin and writes them as tga. Nothing here links against GL.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <cstdlib>
+#include <cstdio>     // for snprintf
+#include <filesystem> // for std::filesystem::create_directories
+
+#include "settings.h"
+#include "core/data_structure.hpp"
+#include "core/system.h"
+#include "core/scene.h"
+#include "core/entity.h"
+#include "core/component.h"
+#include "utils/frame_writer.h"
+#include "utils/frame_sink.h"
+
+using namespace std;
+
+struct Options
+{
+    int frames = 1;
+    string out_dir = "./frames";
+    string asset_root = "../../obj/";
+    string shm_name;             // render into this shared memory ring instead of writing files
+    int shm_slots = 3;
+    int shadow_size = 0; // shadow map resolution, 0 keeps the camera size
+    float orbit_radius = 1.5f;   // distance of the camera to the y axis
+    float orbit_height = 1.5f;   // camera height
+    float orbit_degrees = 360.f; // angle swept over all frames, 0 keeps the camera still
+};
+
+void usage()
+{
+    cout << "Usage: ERer_headless [options]\n"
+         << "  --width N           horizontal resolution (default " << Settings::WIDTH << ")\n"
+         << "  --height N          vertical resolution (default " << Settings::HEIGHT << ")\n"
+         << "  --frames N          number of frames to render (default 1)\n"
+         << "  --out DIR           output directory (default ./frames)\n"
+         << "  --assets DIR        asset root with a trailing slash (default ../../obj/)\n"
+         << "  --orbit-radius R    camera distance to the y axis (default 1.5)\n"
+         << "  --orbit-height H    camera height (default 1.5)\n"
+         << "  --orbit-degrees D   angle swept over all frames (default 360)\n"
+#ifndef _WIN32
+         << "  --shm NAME          publish frames to a shared memory ring instead of --out\n"
+         << "  --shm-slots N       frames in the ring (default 3)\n"
+#endif
+         << "  --shadow-size N     shadow map resolution (default: same as the image)\n";
+}
+
+bool parse_args(int argc, char **argv, Options *opt_p)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+        {
+            return false;
+        }
+        string value = argv[++i];
+        if (arg == "--width")
+            Settings::WIDTH = stoi(value);
+        else if (arg == "--height")
+            Settings::HEIGHT = stoi(value);
+        else if (arg == "--frames")
+            opt_p->frames = stoi(value);
+        else if (arg == "--out")
+            opt_p->out_dir = value;
+        else if (arg == "--assets")
+            opt_p->asset_root = value;
+        else if (arg == "--orbit-radius")
+            opt_p->orbit_radius = stof(value);
+        else if (arg == "--orbit-height")
+            opt_p->orbit_height = stof(value);
+        else if (arg == "--orbit-degrees")
+            opt_p->orbit_degrees = stof(value);
+#ifndef _WIN32
+        else if (arg == "--shm")
+            opt_p->shm_name = value;
+        else if (arg == "--shm-slots")
+            opt_p->shm_slots = stoi(value);
+#else
+        else if (arg == "--shm" || arg == "--shm-slots")
+        {
+            cerr << arg << " is not supported on Windows" << endl; // no POSIX shared memory
+            return false;
+        }
+#endif
+        else if (arg == "--shadow-size")
+            opt_p->shadow_size = stoi(value);
+        else
+            return false;
+    }
+    return Settings::WIDTH > 0 && Settings::HEIGHT > 0 && opt_p->frames > 0 && opt_p->shm_slots > 0 && opt_p->shadow_size >= 0;
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    try
+    {
+        if (!parse_args(argc, argv, &opt))
+        {
+            usage();
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        cerr << "Bad argument: " << e.what() << endl;
+        usage();
+        return 1;
+    }
+    std::error_code ec;
+    if (opt.shm_name.empty())
+    {
+        std::filesystem::create_directories(opt.out_dir, ec);
+    }
+    if (ec)
+    {
+        cerr << "Can't create output directory " << opt.out_dir << ": " << ec.message() << endl;
+        return 1;
+    }
+
+    auto load_start = chrono::steady_clock::now();
+    new Core::RasterizeSystem();
+    Core::cd_to_scene(Core::SceneFactory::build_default_scene(opt.asset_root));
+    for (auto mesh : Core::current_scene->get_all_meshes()) // instanced ones too
+    {
+        mesh->wait_loaded(); // offline frames must be complete
+    }
+    cout << "Scene ready in " << chrono::duration<double>(chrono::steady_clock::now() - load_start).count() * 1000 << " ms" << endl;
+
+    Core::CameraComponent *camera = Core::get_entity("MainCamera")->get_component<Core::CameraComponent>();
+    if (opt.shadow_size > 0)
+    {
+        Core::get_entity("MainLight")->get_component<Core::CameraComponent>()->resize(opt.shadow_size, opt.shadow_size);
+    }
+    Utils::FrameWriter writer;
+#ifndef _WIN32
+    std::unique_ptr<Utils::ShmFrameSink> sink;
+    if (!opt.shm_name.empty())
+    {
+        sink = std::make_unique<Utils::ShmFrameSink>(opt.shm_name, camera->get_width(), camera->get_height(), opt.shm_slots);
+        if (!sink->is_open())
+        {
+            return 1;
+        }
+    }
+#endif
+    double total = 0;
+    for (int frame = 0; frame < opt.frames; ++frame)
+    {
+        // Frame 0 sits where the default scene puts the camera, on the +z axis
+        float theta = static_cast<float>(PI / 2 + opt.orbit_degrees / 360 * PI2 * frame / opt.frames);
+        Core::Vector3f pos{opt.orbit_radius * std::cos(theta), opt.orbit_height, opt.orbit_radius * std::sin(theta)};
+        camera->lookat_with_fixed_up(Core::Vector3f{0, 0, 0} - pos)->set_position(pos);
+
+#ifndef _WIN32
+        // With a sink the camera rasterizes straight into a ring slot
+        Core::Image<Core::RGBA8> slot_color;
+        Core::Image<float> slot_depth;
+        bool to_sink = sink && sink->acquire(&slot_color, &slot_depth);
+        if (to_sink)
+        {
+            camera->swap_color_buffer(slot_color);
+            camera->swap_depth_buffer(slot_depth);
+        }
+#endif
+
+        auto start = chrono::steady_clock::now();
+        for (auto sys : Core::all_systems)
+        {
+            sys->update();
+        }
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        total += sec;
+
+#ifndef _WIN32
+        if (sink)
+        {
+            if (to_sink)
+            {
+                camera->swap_color_buffer(slot_color); // take the own buffers back
+                camera->swap_depth_buffer(slot_depth);
+                sink->present();
+            }
+            cout << "Frame " << frame << ": " << sec * 1000 << " ms -> " << (to_sink ? "shm" : "dropped") << endl;
+            continue;
+        }
+#endif
+
+        char name[32];
+        snprintf(name, sizeof(name), "frame_%04d.tga", frame);
+        string path = (std::filesystem::path(opt.out_dir) / name).string();
+        Core::Image<Core::RGBA8> finished = writer.acquire_color(camera->get_width(), camera->get_height());
+        camera->swap_color_buffer(finished);
+        writer.submit(std::move(finished), path);
+        cout << "Frame " << frame << ": " << sec * 1000 << " ms -> " << path << endl;
+    }
+    writer.flush();
+    if (writer.failed() > 0)
+    {
+        cerr << writer.failed() << " frame(s) could not be written" << endl;
+        return 1;
+    }
+    cout << "Rendered " << opt.frames << " frame(s) at " << Settings::WIDTH << "x" << Settings::HEIGHT << ", "
+         << total / opt.frames * 1000 << " ms per frame" << endl;
+    return 0;
+}
@@ -6,6 +6,8 @@
 #include <cassert>
 #include <initializer_list>
 #include <memory>
+#include <future>
+#include <chrono>
 #include <cstdlib>
 #include <string.h>
 
@@ -18,31 +20,140 @@
 #include "core/entity.h"
 #include "core/component.h"
 #include "core/time.h"
+#include "core/stats.h"
+#include "core/resolution.h"
 #include "utils/loader.h"
+#include "utils/frame_writer.h"
+#include "utils/thread_pool.h"
+#include "utils/resample.h"
 
 #include <typeinfo>
 
 using namespace std;
 
-void display(void)
+const int STATS_PRINT_INTERVAL_S = 5; // with --budget
+bool animate = false; // keep rendering frames (MotionSystem) instead of only while loading
+
+// Render one frame on the worker, true if another frame should follow
+bool render_frame()
 {
-    Core::Time::clock();
+    Core::Time::begin_frame();
     for (auto sys : Core::all_systems)
     {
         sys->update();
     }
-    Core::Time::clock();
+    Core::Time::end_frame();
 
-    // Core::Image<float> dp_img = Core::get_entity("MainLight")->get_component<Core::CameraComponent>()->get_depth_buffer();
-    // Utils::TGAImage dp_img1 = Utils::convert_CoreImage_to_TGAImage(dp_img);
-    // dp_img1.write_tga_file("./dp.tga");
+    if (animate)
+    {
+        return true;
+    }
+    for (auto mesh : Core::current_scene->get_all_meshes()) // instanced ones too
+    {
+        if (mesh->is_loading())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Utils::ThreadPool render_worker(1);
+std::future<bool> frame_in_flight; // the scene is only touched by the worker while this is valid
+std::unique_ptr<Core::ResolutionController> resolution; // null renders at the window size
+int window_width = Settings::WIDTH;
+int window_height = Settings::HEIGHT;
+Core::Image<Core::RGBA8> upscaled; // presented frame at window size when the camera renders smaller
+Core::EntityId main_camera = Core::INVALID_ENTITY; // resolved once, display() runs every frame
+
+void display(void)
+{
+    Core::CameraComponent *camera = Core::get_entity(main_camera)->get_component<Core::CameraComponent>();
+    if (!frame_in_flight.valid())
+    {
+        frame_in_flight = render_worker.submit(render_frame);
+    }
+    bool more = frame_in_flight.get();
+    double frame_ms = Core::Time::get_frame_cost() * 1000; // update() time of the frame just finished
+    camera->present();
+    bool resize = resolution && resolution->frame_done(frame_ms);
+    if (resolution)
+    {
+        static auto last_print = std::chrono::steady_clock::now();
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_print >= std::chrono::seconds(STATS_PRINT_INTERVAL_S))
+        {
+            Core::Stats::print(std::cout);
+            last_print = now;
+        }
+    }
 
-    // Utils::TGAImage color_img = Utils::convert_raw_data_to_TGAImage(Core::get_entity("MainCamera")->get_component<Core::CameraComponent>()->get_color_buffer(), Settings::WIDTH, Settings::HEIGHT, 3);
-    // color_img.write_tga_file("color.tga");
+    // Frame N+1 rasterizes into another target while frame N goes to the screen, a resize waits for the draw
+    if (more && !resize)
+    {
+        frame_in_flight = render_worker.submit(render_frame);
+    }
 
+    const uint8_t *pixels = camera->get_presented_color_buffer();
+    if (camera->get_width() != window_width || camera->get_height() != window_height)
+    {
+        if (upscaled.get_width() != window_width || upscaled.get_height() != window_height)
+        {
+            upscaled = Core::Image<Core::RGBA8>(window_width, window_height);
+        }
+        Utils::resample_bilinear(reinterpret_cast<const Core::RGBA8 *>(pixels), camera->get_width(), camera->get_height(), upscaled.data(), window_width, window_height);
+        pixels = reinterpret_cast<const uint8_t *>(upscaled.data());
+    }
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDrawPixels(Settings::WIDTH, Settings::HEIGHT, GL_BGR_EXT, GL_UNSIGNED_BYTE, Core::get_entity("MainCamera")->get_component<Core::CameraComponent>()->get_color_buffer());
+    glDrawPixels(window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
     glutSwapBuffers(); // swap double buffer
+
+    // Frame capture, the presented target is swapped out and encoded on the writer thread
+    // static Utils::FrameWriter writer;
+    // Core::Image<Core::RGBA8> color_img = writer.acquire_color(camera->get_width(), camera->get_height());
+    // camera->swap_presented_color_buffer(color_img);
+    // writer.submit(std::move(color_img), "./color.tga");
+
+    if (resize)
+    {
+        resolution->apply();
+        if (more)
+        {
+            frame_in_flight = render_worker.submit(render_frame);
+        }
+    }
+    if (frame_in_flight.valid())
+    {
+        glutPostRedisplay();
+    }
+}
+
+// The color camera follows the window size (scaled by the resolution controller), depth (shadow)
+// cameras keep their own resolution
+void reshape(int w, int h)
+{
+    if (w <= 0 || h <= 0)
+    {
+        return;
+    }
+    if (frame_in_flight.valid())
+    {
+        frame_in_flight.wait(); // its targets are reallocated below
+    }
+    glViewport(0, 0, w, h);
+    window_width = w;
+    window_height = h;
+    Core::CameraComponent *camera = Core::get_entity(main_camera)->get_component<Core::CameraComponent>();
+    if (resolution)
+    {
+        resolution->set_output_size(w, h)->apply();
+    }
+    else
+    {
+        camera->resize(w, h);
+    }
+    frame_in_flight = render_worker.submit(render_frame); // rerender at the new size
+    glutPostRedisplay();
 }
 
 void window_init(int argc, char **argv)
@@ -54,19 +165,54 @@ void window_init(int argc, char **argv)
     glutCreateWindow("ERer");
 }
 
-void game_init()
+void game_init(double budget_ms)
 {
     new Core::RasterizeSystem();
-    // new Core::MotionSystem();
+    if (animate)
+    {
+        new Core::MotionSystem();
+    }
     Core::cd_to_scene(Core::SceneFactory::build_default_scene());
+    if (animate)
+    {
+        Core::Entity *test_obj = new Core::Entity("TestObj"); // the object MotionSystem turns
+        Core::add_entity(test_obj);
+        test_obj
+            ->add_component(new Core::MeshComponent())
+            ->load_vertexes_async("../../obj/cube.obj")
+            ->set_albedo_texture_async("../../obj/colormap24.tga")
+            ->set_scala(Core::Vector3f{0.3f, 0.3f, 0.3f})
+            ->set_position(Core::Vector3f{0, 0.3f, 0});
+    }
+    main_camera = Core::get_entity("MainCamera")->uid();
+    Core::CameraComponent *camera = Core::get_entity(main_camera)->get_component<Core::CameraComponent>();
+    camera->set_target_count(2); // present while the next frame renders
+    if (budget_ms > 0)
+    {
+        resolution = std::make_unique<Core::ResolutionController>(camera, budget_ms);
+    }
 }
 
+// ERer [--budget MS] [--animate]
 int main(int argc, char **argv)
 {
+    double budget_ms = 0; // 0 keeps the render resolution at the window size
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+        {
+            budget_ms = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--animate") == 0)
+        {
+            animate = true;
+        }
+    }
     window_init(argc, argv);
-    game_init();
+    game_init(budget_ms);
 
     glutDisplayFunc(display);
+    glutReshapeFunc(reshape);
     // glutIdleFunc(display); // force flush when idle
     glutMainLoop(); // main loop
 
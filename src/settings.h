@@ -4,10 +4,15 @@
 #define PI 3.1415926535
 #define PI2 6.283185307179586
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ERER_USE_SSE2 // x86-64 always has sse2, other targets fall back to scalar code
+#endif
+
 namespace Settings
 {
-    const int WIDTH = 600;  // 水平方向长度
-    const int HEIGHT = 600; // 垂直方向长度
+    // Initial size of new cameras and the window, cameras can be resized afterwards
+    inline int WIDTH = 600;  // 水平方向长度
+    inline int HEIGHT = 600; // 垂直方向长度
 }
 
 #endif // ERER_SETTINGS_H_
\ No newline at end of file
@@ -1,26 +1,75 @@
 #ifndef ERER_UTILS_CONVERT_H_
 #define ERER_UTILS_CONVERT_H_
 
+#include <cstring> // for memcpy
+
 #include "../core/data_structure.hpp"
 #include "../core/image.h"
+#include "../settings.h"
 #include "./tgaimage.h"
 
+#ifdef ERER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace Utils
 {
-    Core::Image<Core::Vector4c> convert_TGAImage_to_CoreImage(const Utils::TGAImage &img)
+    // Swap the r and b bytes of n packed 32-bit texels, bgra -> rgba (the swap is its own inverse)
+    void swizzle_bgra_to_rgba(const uint8_t *src, uint8_t *dst, size_t n)
     {
-        int w = img.get_width();
-        int h = img.get_height();
-        Core::Vector4c *data_p = new Core::Vector4c[w * h]; // delete[] is needless,and it is perfectly safe to delete nullptr
-        for (int y = 0; y < h; ++y)
+        size_t i = 0;
+#ifdef ERER_USE_SSE2
+        const __m128i ga_mask = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+        const __m128i byte_mask = _mm_set1_epi32(0x000000FF);
+        for (; i + 4 <= n; i += 4)
         {
-            for (int x = 0; x < w; ++x)
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+            __m128i ga = _mm_and_si128(p, ga_mask);
+            __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), byte_mask);
+            __m128i b = _mm_slli_epi32(_mm_and_si128(p, byte_mask), 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), _mm_or_si128(ga, _mm_or_si128(r, b)));
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            uint32_t p;
+            memcpy(&p, src + i * 4, 4);
+            p = (p & 0xFF00FF00u) | ((p >> 16) & 0xFFu) | ((p & 0xFFu) << 16);
+            memcpy(dst + i * 4, &p, 4);
+        }
+    }
+
+    // Expand n tga pixels of bytespp bytes (bgra/bgr/gray) to packed rgba
+    void expand_to_rgba(const uint8_t *src, int bytespp, Core::RGBA8 *dst, size_t n)
+    {
+        switch (bytespp)
+        {
+        case 4:
+            swizzle_bgra_to_rgba(src, reinterpret_cast<uint8_t *>(dst), n);
+            break;
+        case 3:
+            for (size_t i = 0; i < n; ++i, src += 3)
             {
-                Utils::TGAColor pp = img.get(x, y);
-                data_p[y * w + x] = Core::Vector4c{pp[2], pp[1], pp[0], pp[3]}; // bgra -> rgba
+                dst[i] = Core::RGBA8(src[2], src[1], src[0]);
             }
+            break;
+        default:
+            for (size_t i = 0; i < n; ++i, ++src)
+            {
+                dst[i] = Core::RGBA8(*src, *src, *src);
+            }
+            break;
         }
-        return Core::Image<Core::Vector4c>(data_p, w, h);
+    }
+
+    Core::Image<Core::RGBA8> convert_TGAImage_to_CoreImage(const Utils::TGAImage &img, Core::ImageLayout layout = Core::ImageLayout::Linear)
+    {
+        int w = img.get_width();
+        int h = img.get_height();
+        Core::Image<Core::RGBA8> ret(w, h);
+        expand_to_rgba(img.buffer(), img.get_bytespp(), ret.data(), static_cast<size_t>(w) * h); // both images are stored top-down row by row
+        ret.to_layout(layout);
+        return ret;
     }
 
     Utils::TGAImage convert_CoreImage_to_TGAImage(const Core::Image<float> &img)
@@ -66,7 +115,7 @@ namespace Utils
         }
     }
 
-    Utils::TGAImage convert_raw_data_to_TGAImage(uint8_t *in_data_p, int w, int h, int bpp)
+    Utils::TGAImage convert_raw_data_to_TGAImage(const uint8_t *in_data_p, int w, int h, int bpp)
     {
         Utils::TGAImage ret(w, h, bpp);
         for (int y = 0; y < h; ++y)
@@ -74,7 +123,8 @@ namespace Utils
             for (int x = 0; x < w; ++x)
             {
                 // rgba -> bgra
-                ret.set(x, y, Utils::TGAColor(in_data_p[bpp * (y * w + x) + 2], in_data_p[bpp * (y * w + x) + 1], in_data_p[bpp * (y * w + x)]));
+                const uint8_t *p = in_data_p + bpp * (y * w + x);
+                ret.set(x, y, Utils::TGAColor(p[0], p[1], p[2], bpp == 4 ? p[3] : 255));
             }
         }
         return ret;
@@ -0,0 +1,325 @@
+#ifndef ERER_UTILS_FRAME_SINK_H_
+#define ERER_UTILS_FRAME_SINK_H_
+
+#include <cstdint>
+#include <cstddef> // for size_t
+#include <cstring> // for memcpy memcmp
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <new> // for placement new
+#include <iostream>
+
+#include "../core/data_structure.hpp"
+#include "../core/image.h"
+
+#ifndef _WIN32
+#include <fcntl.h>    // for O_* constants
+#include <unistd.h>   // for ftruncate close
+#include <sys/mman.h> // for shm_open mmap
+#include <sys/stat.h> // for fstat
+#endif
+
+namespace Utils
+{
+    // Destination of finished frames. The renderer asks for a target, rasterizes straight into it
+    // and presents it; the sink decides where the memory lives.
+    class FrameSink
+    {
+    public:
+        virtual ~FrameSink()
+        {
+        }
+        // Views to render the next frame into, false when the sink has no free target (drop the frame)
+        virtual bool acquire(Core::Image<Core::RGBA8> *color_p, Core::Image<float> *depth_p) = 0;
+        // Publish the frame rendered into the views of the last acquire
+        virtual void present() = 0;
+    };
+
+#ifndef _WIN32
+    // Shared memory layout: ShmFrameHeader, then slot_count slots of [ShmSlotHeader | rgba | depth].
+    // Each slot carries a sequence number (bounded queue after Vyukov): seq == n means free for
+    // frame n, seq == n + 1 means frame n is ready, the consumer releases it with seq = n + slot_count.
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory handoff needs lock-free atomics");
+
+    constexpr char SHM_FRAME_MAGIC[4] = {'E', 'R', 'F', 'B'};
+    constexpr uint32_t SHM_FRAME_VERSION = 1;
+
+    enum ShmFrameState : uint32_t
+    {
+        ShmInitializing = 0,
+        ShmLive,
+        ShmClosed // the producer is gone, no frame after the published ones will come
+    };
+
+    struct ShmFrameHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t slot_count;
+        std::atomic<uint32_t> state;
+        uint64_t slot_size;    // bytes per slot including its header
+        uint64_t color_offset; // from the slot start, packed rgba rows bottom to top
+        uint64_t depth_offset; // from the slot start, float view depth
+    };
+
+    struct ShmSlotHeader
+    {
+        std::atomic<uint64_t> seq;
+        uint64_t frame; // producer frame counter, dropped frames leave gaps
+        double time;    // seconds since the sink was created
+    };
+
+    inline size_t shm_align(size_t n)
+    {
+        return (n + 63) & ~static_cast<size_t>(63);
+    }
+
+    // Producer side: creates /name, rendering goes straight into the slots
+    class ShmFrameSink : public FrameSink
+    {
+    private:
+        std::string name_;
+        uint8_t *base_ = nullptr;
+        size_t size_ = 0;
+        ShmFrameHeader *header_ = nullptr;
+        uint64_t next_ = 0;     // next frame sequence to write
+        uint64_t frame_ = 0;    // frames offered, including dropped ones
+        uint64_t dropped_ = 0;
+        bool acquired_ = false;
+        std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+
+        ShmSlotHeader *slot(uint64_t seq)
+        {
+            return reinterpret_cast<ShmSlotHeader *>(base_ + shm_align(sizeof(ShmFrameHeader)) + (seq % header_->slot_count) * header_->slot_size);
+        }
+
+    public:
+        ShmFrameSink(const std::string &name, int w, int h, int slot_count = 3) : name_(name.empty() || name[0] == '/' ? name : "/" + name)
+        {
+            size_t color_bytes = shm_align(sizeof(Core::RGBA8) * w * h);
+            size_t depth_bytes = shm_align(sizeof(float) * w * h);
+            size_t slot_size = shm_align(sizeof(ShmSlotHeader)) + color_bytes + depth_bytes;
+            size_ = shm_align(sizeof(ShmFrameHeader)) + slot_size * slot_count;
+
+            shm_unlink(name_.c_str()); // a crashed producer may have left one behind
+            int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0)
+            {
+                std::cerr << "can't create shared memory " << name_ << "\n";
+                return;
+            }
+            if (ftruncate(fd, static_cast<off_t>(size_)) != 0)
+            {
+                std::cerr << "can't resize shared memory " << name_ << "\n";
+                ::close(fd);
+                shm_unlink(name_.c_str());
+                return;
+            }
+            void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd); // the mapping keeps the object alive
+            if (p == MAP_FAILED)
+            {
+                std::cerr << "can't map shared memory " << name_ << "\n";
+                shm_unlink(name_.c_str());
+                return;
+            }
+            base_ = static_cast<uint8_t *>(p);
+            header_ = new (base_) ShmFrameHeader(); // fresh shm pages are zero, so state starts as ShmInitializing
+            header_->version = SHM_FRAME_VERSION;
+            header_->width = w;
+            header_->height = h;
+            header_->slot_count = slot_count;
+            header_->slot_size = slot_size;
+            header_->color_offset = shm_align(sizeof(ShmSlotHeader));
+            header_->depth_offset = header_->color_offset + color_bytes;
+            for (int i = 0; i < slot_count; ++i)
+            {
+                new (slot(i)) ShmSlotHeader();
+                slot(i)->seq.store(i, std::memory_order_relaxed);
+            }
+            memcpy(header_->magic, SHM_FRAME_MAGIC, sizeof(SHM_FRAME_MAGIC));
+            header_->state.store(ShmLive, std::memory_order_release); // consumers wait for this
+        }
+        ~ShmFrameSink()
+        {
+            if (base_ != nullptr)
+            {
+                header_->state.store(ShmClosed, std::memory_order_release);
+                munmap(base_, size_);
+                shm_unlink(name_.c_str()); // consumers that mapped it keep their mapping
+            }
+        }
+        ShmFrameSink(const ShmFrameSink &other) = delete;
+        ShmFrameSink &operator=(const ShmFrameSink &other) = delete;
+
+        bool is_open() const
+        {
+            return base_ != nullptr;
+        }
+
+        bool acquire(Core::Image<Core::RGBA8> *color_p, Core::Image<float> *depth_p) override
+        {
+            ++frame_;
+            if (base_ == nullptr || slot(next_)->seq.load(std::memory_order_acquire) != next_)
+            {
+                ++dropped_; // the consumer still holds this slot, never wait on it
+                return false;
+            }
+            uint8_t *s = reinterpret_cast<uint8_t *>(slot(next_));
+            *color_p = Core::Image<Core::RGBA8>::view(reinterpret_cast<Core::RGBA8 *>(s + header_->color_offset), header_->width, header_->height);
+            *depth_p = Core::Image<float>::view(reinterpret_cast<float *>(s + header_->depth_offset), header_->width, header_->height);
+            acquired_ = true;
+            return true;
+        }
+
+        void present() override
+        {
+            if (!acquired_)
+            {
+                return;
+            }
+            ShmSlotHeader *s = slot(next_);
+            s->frame = frame_ - 1;
+            s->time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+            s->seq.store(next_ + 1, std::memory_order_release);
+            ++next_;
+            acquired_ = false;
+        }
+
+        uint64_t dropped() const
+        {
+            return dropped_;
+        }
+    };
+
+    // Consumer side: maps an existing /name and reads frames in place
+    class ShmFrameSource
+    {
+    private:
+        uint8_t *base_ = nullptr;
+        size_t size_ = 0;
+        const ShmFrameHeader *header_ = nullptr;
+        uint64_t next_ = 0; // next frame sequence to read
+
+        ShmSlotHeader *slot(uint64_t seq) const
+        {
+            return reinterpret_cast<ShmSlotHeader *>(base_ + shm_align(sizeof(ShmFrameHeader)) + (seq % header_->slot_count) * header_->slot_size);
+        }
+
+    public:
+        struct Frame
+        {
+            uint64_t frame;
+            double time;
+            int width;
+            int height;
+            const Core::RGBA8 *color;
+            const float *depth;
+        };
+
+        ShmFrameSource()
+        {
+        }
+        ~ShmFrameSource()
+        {
+            close();
+        }
+        ShmFrameSource(const ShmFrameSource &other) = delete;
+        ShmFrameSource &operator=(const ShmFrameSource &other) = delete;
+
+        // False while the producer has not created or finished initializing the ring, or when the
+        // ring its header describes doesn't fit the shared memory object
+        bool open(const std::string &name)
+        {
+            close();
+            std::string path = name.empty() || name[0] == '/' ? name : "/" + name;
+            int fd = shm_open(path.c_str(), O_RDWR, 0600);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < shm_align(sizeof(ShmFrameHeader)))
+            {
+                ::close(fd);
+                return false;
+            }
+            void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); // writable for the slot sequence numbers
+            ::close(fd);
+            if (p == MAP_FAILED)
+            {
+                return false;
+            }
+            base_ = static_cast<uint8_t *>(p);
+            size_ = st.st_size;
+            header_ = reinterpret_cast<const ShmFrameHeader *>(base_);
+            if (header_->state.load(std::memory_order_acquire) == ShmInitializing || memcmp(header_->magic, SHM_FRAME_MAGIC, sizeof(SHM_FRAME_MAGIC)) != 0 || header_->version != SHM_FRAME_VERSION)
+            {
+                close();
+                return false;
+            }
+            // The ring and every slot's images must lie inside the mapping
+            size_t rings = size_ - shm_align(sizeof(ShmFrameHeader));
+            uint64_t pixels = static_cast<uint64_t>(header_->width) * header_->height;
+            if (header_->slot_count == 0 || header_->slot_size < sizeof(ShmSlotHeader) || header_->slot_size > rings / header_->slot_count ||
+                header_->color_offset < sizeof(ShmSlotHeader) || header_->color_offset > header_->slot_size || pixels > (header_->slot_size - header_->color_offset) / sizeof(Core::RGBA8) ||
+                header_->depth_offset < sizeof(ShmSlotHeader) || header_->depth_offset > header_->slot_size || pixels > (header_->slot_size - header_->depth_offset) / sizeof(float))
+            {
+                close();
+                return false;
+            }
+            next_ = 0;
+            return true;
+        }
+
+        void close()
+        {
+            if (base_ != nullptr)
+            {
+                munmap(base_, size_);
+                base_ = nullptr;
+                header_ = nullptr;
+            }
+        }
+
+        bool is_closed() const
+        {
+            return header_ == nullptr || header_->state.load(std::memory_order_acquire) == ShmClosed;
+        }
+
+        // The oldest unread frame, valid until release(); false if none is ready yet
+        bool peek(Frame *frame_p) const
+        {
+            if (header_ == nullptr)
+            {
+                return false;
+            }
+            ShmSlotHeader *s = slot(next_);
+            if (s->seq.load(std::memory_order_acquire) != next_ + 1)
+            {
+                return false;
+            }
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(s);
+            frame_p->frame = s->frame;
+            frame_p->time = s->time;
+            frame_p->width = header_->width;
+            frame_p->height = header_->height;
+            frame_p->color = reinterpret_cast<const Core::RGBA8 *>(p + header_->color_offset);
+            frame_p->depth = reinterpret_cast<const float *>(p + header_->depth_offset);
+            return true;
+        }
+
+        // Hand the slot of the frame returned by peek() back to the producer
+        void release()
+        {
+            slot(next_)->seq.store(next_ + header_->slot_count, std::memory_order_release);
+            ++next_;
+        }
+    };
+#endif
+}
+
+#endif // ERER_UTILS_FRAME_SINK_H_
@@ -0,0 +1,340 @@
+#ifndef ERER_UTILS_FRAME_WRITER_H_
+#define ERER_UTILS_FRAME_WRITER_H_
+
+#include <cstdint>
+#include <cstring> // for memcpy
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "../core/data_structure.hpp"
+#include "../core/image.h"
+#include "./tgaimage.h"
+#include "./convert.h"
+#include "./thread_pool.h"
+
+namespace Utils
+{
+    // Writes finished frames to rle tga files on a background thread. Buffers are handed over by
+    // move (swap them out of the camera first), so submitting costs no copy; the encoded buffers go
+    // back to a free list for the next acquire_*. The queue is bounded and submit blocks while full.
+    class FrameWriter
+    {
+    private:
+        static constexpr int MIN_BLOCK_ROWS = 32; // rows per encoding task
+
+        struct Job
+        {
+            std::string filename;
+            bool is_depth = false;
+            Core::Image<Core::RGBA8> color;
+            Core::Image<float> depth;
+        };
+
+        std::deque<Job> queue_;
+        std::vector<Core::Image<Core::RGBA8>> free_colors_;
+        std::vector<Core::Image<float>> free_depths_;
+        size_t capacity_;
+        int busy_ = 0; // jobs taken off the queue but not written yet
+        size_t written_ = 0;
+        size_t failed_ = 0;
+        bool stop_ = false;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::unique_ptr<ThreadPool> encoders_; // null when encoding on the writer thread only
+        std::thread worker_;
+
+        // Append rle packets for n pixels of one scanline, packets never cross a scanline
+        static void encode_rle_row(const uint8_t *row, int n, int bytespp, std::vector<uint8_t> &out)
+        {
+            auto same = [row, bytespp](int a, int b)
+            {
+                return memcmp(row + a * bytespp, row + b * bytespp, bytespp) == 0;
+            };
+            int x = 0;
+            while (x < n)
+            {
+                int run = 1;
+                while (x + run < n && run < 128 && same(x, x + run))
+                {
+                    ++run;
+                }
+                if (run > 1)
+                {
+                    out.push_back(static_cast<uint8_t>(run + 127));
+                    out.insert(out.end(), row + x * bytespp, row + (x + 1) * bytespp);
+                    x += run;
+                    continue;
+                }
+                int raw = 1; // raw packet stops in front of the next pair of equal pixels
+                while (x + raw < n && raw < 128 && !(x + raw + 1 < n && same(x + raw, x + raw + 1)))
+                {
+                    ++raw;
+                }
+                out.push_back(static_cast<uint8_t>(raw - 1));
+                out.insert(out.end(), row + x * bytespp, row + (x + raw) * bytespp);
+                x += raw;
+            }
+        }
+
+        // Rows [y0, y1) of a color frame as bgra rle
+        static std::vector<uint8_t> encode_color_rows(const Core::Image<Core::RGBA8> &img, int y0, int y1)
+        {
+            int w = img.get_width();
+            std::vector<uint8_t> bgra(static_cast<size_t>(w) * 4);
+            std::vector<uint8_t> out;
+            out.reserve(static_cast<size_t>(w) * (y1 - y0) * 2);
+            for (int y = y0; y < y1; ++y)
+            {
+                swizzle_bgra_to_rgba(reinterpret_cast<const uint8_t *>(img.data() + static_cast<size_t>(y) * w), bgra.data(), w);
+                encode_rle_row(bgra.data(), w, 4, out);
+            }
+            return out;
+        }
+
+        // Rows [y0, y1) of a depth frame as 8-bit grayscale rle, scaled by the frame's max depth
+        static std::vector<uint8_t> encode_depth_rows(const Core::Image<float> &img, int y0, int y1, float max_dp)
+        {
+            int w = img.get_width();
+            std::vector<uint8_t> gray(w);
+            std::vector<uint8_t> out;
+            out.reserve(static_cast<size_t>(w) * (y1 - y0));
+            const float *src = img.data();
+            for (int y = y0; y < y1; ++y)
+            {
+                for (int x = 0; x < w; ++x)
+                {
+                    gray[x] = static_cast<uint8_t>(src[static_cast<size_t>(y) * w + x] / max_dp * 255);
+                }
+                encode_rle_row(gray.data(), w, 1, out);
+            }
+            return out;
+        }
+
+        template <typename F>
+        std::vector<std::vector<uint8_t>> encode_blocks(int height, F &&encode)
+        {
+            int blocks = encoders_ ? std::min(encoders_->size() * 2, (height + MIN_BLOCK_ROWS - 1) / MIN_BLOCK_ROWS) : 1;
+            blocks = std::max(blocks, 1);
+            std::vector<std::vector<uint8_t>> ret(blocks);
+            if (blocks == 1)
+            {
+                ret[0] = encode(0, height);
+                return ret;
+            }
+            std::vector<std::future<std::vector<uint8_t>>> futures;
+            for (int i = 0; i < blocks; ++i)
+            {
+                int y0 = height * i / blocks;
+                int y1 = height * (i + 1) / blocks;
+                futures.push_back(encoders_->submit([&encode, y0, y1]()
+                                                    { return encode(y0, y1); }));
+            }
+            for (int i = 0; i < blocks; ++i)
+            {
+                ret[i] = futures[i].get();
+            }
+            return ret;
+        }
+
+        static bool write_file(const std::string &filename, int w, int h, int bytespp, const std::vector<std::vector<uint8_t>> &blocks)
+        {
+            std::ofstream out(filename, std::ios::binary);
+            if (!out.is_open())
+            {
+                std::cerr << "can't open file " << filename << "\n";
+                return false;
+            }
+            TGA_Header header;
+            header.bitsperpixel = static_cast<uint8_t>(bytespp << 3);
+            header.width = static_cast<uint16_t>(w);
+            header.height = static_cast<uint16_t>(h);
+            header.datatypecode = bytespp == 1 ? 11 : 10; // rle grayscale / rle true color
+            header.imagedescriptor = 0x00;                // bottom-left origin, frame rows go bottom to top
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            for (const auto &block : blocks)
+            {
+                out.write(reinterpret_cast<const char *>(block.data()), block.size());
+            }
+            const uint8_t footer[26] = {0, 0, 0, 0, 0, 0, 0, 0, 'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+            out.write(reinterpret_cast<const char *>(footer), sizeof(footer));
+            if (!out.good())
+            {
+                std::cerr << "can't dump the tga file " << filename << "\n";
+                return false;
+            }
+            return true;
+        }
+
+        bool write_job(Job &job)
+        {
+            if (job.is_depth)
+            {
+                Core::Image<float> &img = job.depth.to_layout(Core::ImageLayout::Linear);
+                const float *src = img.data();
+                size_t n = static_cast<size_t>(img.get_width()) * img.get_height();
+                float max_dp = *std::max_element(src, src + n);
+                max_dp = max_dp > 0.f ? max_dp : 1.f;
+                auto blocks = encode_blocks(img.get_height(), [&img, max_dp](int y0, int y1)
+                                            { return encode_depth_rows(img, y0, y1, max_dp); });
+                return write_file(job.filename, img.get_width(), img.get_height(), 1, blocks);
+            }
+            Core::Image<Core::RGBA8> &img = job.color.to_layout(Core::ImageLayout::Linear);
+            auto blocks = encode_blocks(img.get_height(), [&img](int y0, int y1)
+                                        { return encode_color_rows(img, y0, y1); });
+            return write_file(job.filename, img.get_width(), img.get_height(), 4, blocks);
+        }
+
+        void run()
+        {
+            for (;;)
+            {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this]()
+                             { return stop_ || !queue_.empty(); });
+                    if (queue_.empty())
+                    {
+                        return; // stopped and drained
+                    }
+                    job = std::move(queue_.front());
+                    queue_.pop_front();
+                    ++busy_;
+                }
+                cv_.notify_all(); // a queue slot is free
+
+                bool ok = write_job(job);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    --busy_;
+                    ok ? ++written_ : ++failed_;
+                    if (job.is_depth && free_depths_.size() <= capacity_)
+                    {
+                        free_depths_.push_back(std::move(job.depth));
+                    }
+                    else if (!job.is_depth && free_colors_.size() <= capacity_)
+                    {
+                        free_colors_.push_back(std::move(job.color));
+                    }
+                }
+                cv_.notify_all();
+            }
+        }
+
+        void push(Job &&job)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]()
+                         { return queue_.size() < capacity_; });
+                queue_.push_back(std::move(job));
+            }
+            cv_.notify_all();
+        }
+
+        template <typename T>
+        static Core::Image<T> take_free(std::vector<Core::Image<T>> &free_list, int w, int h)
+        {
+            for (size_t i = 0; i < free_list.size(); ++i)
+            {
+                if (free_list[i].get_width() == w && free_list[i].get_height() == h)
+                {
+                    Core::Image<T> ret = std::move(free_list[i]);
+                    free_list.erase(free_list.begin() + i);
+                    return ret;
+                }
+            }
+            return Core::Image<T>(w, h);
+        }
+
+    public:
+        // capacity: frames that may wait in the queue; encode_threads: 0 for one per core, 1 to encode on the writer thread
+        FrameWriter(size_t capacity = 4, int encode_threads = 0) : capacity_(std::max<size_t>(capacity, 1))
+        {
+            if (encode_threads <= 0)
+            {
+                encode_threads = static_cast<int>(std::thread::hardware_concurrency());
+            }
+            if (encode_threads > 1)
+            {
+                encoders_ = std::make_unique<ThreadPool>(encode_threads);
+            }
+            worker_ = std::thread([this]()
+                                  { run(); });
+        }
+        ~FrameWriter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            worker_.join(); // pending frames are still written
+        }
+        FrameWriter(const FrameWriter &other) = delete;
+        FrameWriter &operator=(const FrameWriter &other) = delete;
+
+        // A w x h buffer to swap into the camera, recycled from already written frames when possible
+        Core::Image<Core::RGBA8> acquire_color(int w, int h)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return take_free(free_colors_, w, h);
+        }
+        Core::Image<float> acquire_depth(int w, int h)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return take_free(free_depths_, w, h);
+        }
+
+        // Queue a packed rgba frame, rows bottom to top as the camera stores them
+        void submit(Core::Image<Core::RGBA8> &&color, const std::string &filename)
+        {
+            Job job;
+            job.filename = filename;
+            job.color = std::move(color);
+            push(std::move(job));
+        }
+
+        // Queue a depth frame, written as grayscale normalized by its max depth
+        void submit(Core::Image<float> &&depth, const std::string &filename)
+        {
+            Job job;
+            job.filename = filename;
+            job.is_depth = true;
+            job.depth = std::move(depth);
+            push(std::move(job));
+        }
+
+        // Block until every submitted frame is on disk
+        void flush()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]()
+                     { return queue_.empty() && busy_ == 0; });
+        }
+
+        size_t written()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return written_;
+        }
+
+        size_t failed()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return failed_;
+        }
+    };
+}
+
+#endif // ERER_UTILS_FRAME_WRITER_H_
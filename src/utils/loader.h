@@ -3,81 +3,367 @@
 
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <vector>
-#include <string>
-#include "../core/data_structure.hpp"
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <charconv> // for std::from_chars
+#include <climits>  // for INT_MIN
+#include <cstdint>
+#include <cmath>
+
+#include "mapped_file.h"
 
 namespace Utils
 {
-    void load_obj_file(const std::string filename, std::vector<Core::Vector3f> *vertices_p, std::vector<Core::Vector3f> *uvs_p, std::vector<Core::Vector3f> *normals_p, std::vector<Core::Matrix3i> *faces_p)
+    // Flat, indexed triangle mesh. Every vertex is a unique (position, uv, normal) combination of the obj.
+    struct ObjMesh
     {
-        std::ifstream in;
-        in.open(filename, std::ifstream::in);
-        if (in.fail())
+        std::vector<float> positions;  // xyz per vertex
+        std::vector<float> uvs;        // uv per vertex, zero when the obj has none
+        std::vector<float> normals;    // xyz per vertex, smoothed face normals when the obj has none
+        std::vector<uint32_t> indices; // three per triangle
+
+        size_t vertex_count() const
+        {
+            return positions.size() / 3;
+        }
+        size_t triangle_count() const
+        {
+            return indices.size() / 3;
+        }
+    };
+
+    namespace ObjParser
+    {
+        const int MISSING = INT_MIN;
+
+        struct Corner
+        {
+            int idx[3];       // position, uv, normal
+            uint8_t relative; // bit i set: idx[i] came from a negative index and is relative to the chunk start
+        };
+
+        // What one thread parsed out of its chunk of lines
+        struct Chunk
+        {
+            std::vector<float> positions; // xyz
+            std::vector<float> uvs;       // uv
+            std::vector<float> normals;   // xyz
+            std::vector<Corner> corners;  // three per triangle, n-gons already fanned
+        };
+
+        inline const char *skip_spaces(const char *p, const char *end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t'))
+            {
+                ++p;
+            }
+            return p;
+        }
+
+        inline const char *next_line(const char *p, const char *end)
+        {
+            while (p < end && *p != '\n')
+            {
+                ++p;
+            }
+            return p < end ? p + 1 : end;
+        }
+
+        inline const char *parse_floats(const char *p, const char *end, int n, std::vector<float> *out_p)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                p = skip_spaces(p, end);
+                float value = 0.f;
+                auto res = std::from_chars(p, end, value);
+                p = res.ptr; // a missing component stays zero
+                out_p->push_back(value);
+            }
+            return p;
+        }
+
+        // Parse {v}, {v/vt}, {v//vn} or {v/vt/vn}
+        inline const char *parse_corner(const char *p, const char *end, const int counts[3], Corner *corner_p)
+        {
+            corner_p->relative = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                corner_p->idx[k] = MISSING;
+                if (k > 0)
+                {
+                    if (p >= end || *p != '/')
+                    {
+                        continue;
+                    }
+                    ++p;
+                }
+                int value = 0;
+                auto res = std::from_chars(p, end, value);
+                if (res.ec != std::errc() || value == 0)
+                {
+                    continue; // empty slot such as {1//3}
+                }
+                p = res.ptr;
+                if (value > 0)
+                {
+                    corner_p->idx[k] = value - 1; // in wavefront obj all indices start at 1, not zero
+                }
+                else
+                {
+                    corner_p->idx[k] = counts[k] + value; // relative to what this chunk has read so far
+                    corner_p->relative |= 1 << k;
+                }
+            }
+            return p;
+        }
+
+        inline void parse_chunk(const char *p, const char *end, Chunk *chunk_p)
+        {
+            std::vector<Corner> polygon;
+            while (p < end)
+            {
+                const char *line = skip_spaces(p, end);
+                p = next_line(line, end);
+                if (end - line < 2)
+                {
+                    continue;
+                }
+                if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t'))
+                {
+                    parse_floats(line + 2, p, 3, &chunk_p->positions);
+                }
+                else if (line[0] == 'v' && line[1] == 't')
+                {
+                    parse_floats(line + 2, p, 2, &chunk_p->uvs);
+                }
+                else if (line[0] == 'v' && line[1] == 'n')
+                {
+                    parse_floats(line + 2, p, 3, &chunk_p->normals);
+                }
+                else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
+                {
+                    const int counts[3] = {static_cast<int>(chunk_p->positions.size() / 3), static_cast<int>(chunk_p->uvs.size() / 2), static_cast<int>(chunk_p->normals.size() / 3)};
+                    polygon.clear();
+                    const char *q = skip_spaces(line + 2, p);
+                    while (q < p && *q != '\n' && *q != '\r' && *q != '#')
+                    {
+                        Corner c;
+                        const char *next = parse_corner(q, p, counts, &c);
+                        if (next == q)
+                        {
+                            break; // garbage
+                        }
+                        polygon.push_back(c);
+                        q = skip_spaces(next, p);
+                    }
+                    for (size_t i = 2; i < polygon.size(); ++i) // fan triangulation
+                    {
+                        chunk_p->corners.push_back(polygon[0]);
+                        chunk_p->corners.push_back(polygon[i - 1]);
+                        chunk_p->corners.push_back(polygon[i]);
+                    }
+                }
+            }
+        }
+
+        struct CornerKey
+        {
+            int idx[3];
+            bool operator==(const CornerKey &other) const
+            {
+                return idx[0] == other.idx[0] && idx[1] == other.idx[1] && idx[2] == other.idx[2];
+            }
+        };
+
+        struct CornerHash
+        {
+            size_t operator()(const CornerKey &key) const
+            {
+                uint64_t h = static_cast<uint32_t>(key.idx[0]);
+                h = h * 0x9E3779B97F4A7C15ULL ^ static_cast<uint32_t>(key.idx[1]);
+                h = h * 0x9E3779B97F4A7C15ULL ^ static_cast<uint32_t>(key.idx[2]);
+                return static_cast<size_t>(h ^ (h >> 32));
+            }
+        };
+    }
+
+    // Memory-maps the obj, parses line-aligned chunks on num_threads threads (0 means all cores) and
+    // builds a flat indexed mesh. Faces may be triangles, quads or n-gons, uv and normal are optional,
+    // negative (relative) indices are supported.
+    bool load_obj_file(const std::string &filename, ObjMesh *mesh_p, int num_threads = 0)
+    {
+        using namespace ObjParser;
+        MappedFile file(filename);
+        if (!file.is_open())
         {
             std::cout << "Can't find obj file!" << std::endl;
-            return;
+            return false;
+        }
+        const char *begin = file.data();
+        const char *end = begin + file.size();
+
+        // Split at line boundaries, at least 256KB per chunk
+        const size_t min_chunk = 1 << 18;
+        int hw = static_cast<int>(std::thread::hardware_concurrency());
+        int n = num_threads > 0 ? num_threads : (hw > 0 ? hw : 1);
+        n = static_cast<int>(std::max<size_t>(1, std::min<size_t>(n, file.size() / min_chunk)));
+        std::vector<const char *> bounds{begin};
+        for (int i = 1; i < n; ++i)
+        {
+            const char *p = std::max(bounds.back(), begin + file.size() * i / n);
+            bounds.push_back(next_line(p, end));
         }
+        bounds.push_back(end);
 
-        std::string line;
-        char trash;
-        float value;
-        Core::Vector3f v;
-        Core::Matrix3i m;
-        while (!in.eof())
+        std::vector<Chunk> chunks(bounds.size() - 1);
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < chunks.size(); ++i)
         {
-            std::getline(in, line);
-            std::istringstream iss(line.c_str()); // C++ style stream input
-            if (!line.compare(0, 2, "v "))
+            workers.emplace_back(parse_chunk, bounds[i], bounds[i + 1], &chunks[i]);
+        }
+        parse_chunk(bounds[0], bounds[1], &chunks[0]);
+        for (auto &w : workers)
+        {
+            w.join();
+        }
+
+        // Concatenate attributes and resolve indices with the chunk base offsets
+        std::vector<float> positions, uvs, normals;
+        std::vector<Corner> corners;
+        for (auto &chunk : chunks)
+        {
+            const int base[3] = {static_cast<int>(positions.size() / 3), static_cast<int>(uvs.size() / 2), static_cast<int>(normals.size() / 3)};
+            for (Corner c : chunk.corners)
             {
-                iss >> trash; // read {v } in {v 0.1 0.2 0.3} to trash, stopping while encounter space charactor
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (c.relative & (1 << k))
+                    {
+                        c.idx[k] += base[k];
+                    }
+                }
+                corners.push_back(c);
+            }
+            positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+            uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+            normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+            chunk = Chunk(); // release early
+        }
+        const int counts[3] = {static_cast<int>(positions.size() / 3), static_cast<int>(uvs.size() / 2), static_cast<int>(normals.size() / 3)};
 
-                for (int i = 0; i < 3; i++)
+        // Deduplicate (position, uv, normal) combinations into indexed vertexes
+        mesh_p->positions.clear();
+        mesh_p->uvs.clear();
+        mesh_p->normals.clear();
+        mesh_p->indices.clear();
+        std::unordered_map<CornerKey, uint32_t, CornerHash> vertex_ids;
+        vertex_ids.reserve(corners.size() / 2);
+        std::vector<bool> generated_normal;
+        size_t bad_faces = 0;
+        for (size_t t = 0; t + 3 <= corners.size(); t += 3)
+        {
+            bool valid = true;
+            for (int j = 0; j < 3 && valid; ++j)
+            {
+                const Corner &c = corners[t + j];
+                valid = c.idx[0] >= 0 && c.idx[0] < counts[0];
+                for (int k = 1; k < 3 && valid; ++k)
                 {
-                    iss >> value;
-                    v[i] = value;
-                } // read {0.1 0.2 0.3} to v[i]
-                vertices_p->push_back(v);
+                    valid = c.idx[k] == MISSING || (c.idx[k] >= 0 && c.idx[k] < counts[k]);
+                }
             }
-            else if (!line.compare(0, 3, "vt "))
+            if (!valid)
             {
-                iss >> trash >> trash; // read {vt } in {vt 0.1 0.2} to trash, stopping while encounter space charactor
-                for (int i = 0; i < 2; i++)
+                ++bad_faces;
+                continue;
+            }
+            uint32_t tri[3];
+            for (int j = 0; j < 3; ++j)
+            {
+                const Corner &c = corners[t + j];
+                CornerKey key{{c.idx[0], c.idx[1], c.idx[2]}};
+                auto iter = vertex_ids.find(key);
+                if (iter != vertex_ids.end())
+                {
+                    tri[j] = iter->second;
+                    continue;
+                }
+                uint32_t id = static_cast<uint32_t>(mesh_p->vertex_count());
+                vertex_ids.emplace(key, id);
+                mesh_p->positions.insert(mesh_p->positions.end(), &positions[3 * c.idx[0]], &positions[3 * c.idx[0]] + 3);
+                if (c.idx[1] != MISSING)
                 {
-                    iss >> value;
-                    v[i] = value;
+                    mesh_p->uvs.insert(mesh_p->uvs.end(), &uvs[2 * c.idx[1]], &uvs[2 * c.idx[1]] + 2);
                 }
-                v[2] = 0;
-                uvs_p->push_back(v);
+                else
+                {
+                    mesh_p->uvs.insert(mesh_p->uvs.end(), 2, 0.f);
+                }
+                if (c.idx[2] != MISSING)
+                {
+                    mesh_p->normals.insert(mesh_p->normals.end(), &normals[3 * c.idx[2]], &normals[3 * c.idx[2]] + 3);
+                }
+                else
+                {
+                    mesh_p->normals.insert(mesh_p->normals.end(), 3, 0.f);
+                }
+                generated_normal.push_back(c.idx[2] == MISSING);
+                tri[j] = id;
             }
-            else if (!line.compare(0, 3, "vn "))
+            mesh_p->indices.insert(mesh_p->indices.end(), tri, tri + 3);
+        }
+        if (bad_faces)
+        {
+            std::clog << filename << ": skipped " << bad_faces << " triangle(s) with out of range indices" << std::endl;
+        }
+
+        // Vertexes without normal get the area weighted average of their face normals
+        bool need_normals = false;
+        for (bool g : generated_normal)
+        {
+            need_normals |= g;
+        }
+        if (need_normals)
+        {
+            float *pos = mesh_p->positions.data();
+            float *nrm = mesh_p->normals.data();
+            for (size_t t = 0; t < mesh_p->indices.size(); t += 3)
             {
-                iss >> trash >> trash; // read {vn } in {vn 0.1 0.2 0.3} to trash, stopping while encounter space charactor
-                for (int i = 0; i < 3; i++)
+                const uint32_t *tri = &mesh_p->indices[t];
+                float e1[3], e2[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    e1[k] = pos[3 * tri[1] + k] - pos[3 * tri[0] + k];
+                    e2[k] = pos[3 * tri[2] + k] - pos[3 * tri[0] + k];
+                }
+                float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+                for (int j = 0; j < 3; ++j)
                 {
-                    iss >> value;
-                    v[i] = value;
+                    if (generated_normal[tri[j]])
+                    {
+                        for (int k = 0; k < 3; ++k)
+                        {
+                            nrm[3 * tri[j] + k] += n[k];
+                        }
+                    }
                 }
-                normals_p->push_back(v);
             }
-            else if (!line.compare(0, 2, "f "))
+            for (size_t v = 0; v < generated_normal.size(); ++v)
             {
-                int vert_idx, uv_idx, normal_idx, i = 0;
-                iss >> trash; // read {f} in {f 1/1/1 5/10/1 8/14/6} to trash, 1 5 8 is index of vertex instead of 1 1 1
-                while (iss >> vert_idx >> trash >> uv_idx >> trash >> normal_idx)
+                float len = std::sqrt(nrm[3 * v] * nrm[3 * v] + nrm[3 * v + 1] * nrm[3 * v + 1] + nrm[3 * v + 2] * nrm[3 * v + 2]);
+                if (generated_normal[v] && len > 0)
                 {
-                    vert_idx--, uv_idx--, normal_idx--; // in wavefront obj all indices start at 1, not zero
-                    m[0][i] = vert_idx;
-                    m[1][i] = uv_idx;
-                    m[2][i] = normal_idx;
-                    ++i;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        nrm[3 * v + k] /= len;
+                    }
                 }
-                faces_p->push_back(m);
             }
         }
+        return true;
     }
 }
 
-#endif // ERER_UTILS_LOADER_H_
\ No newline at end of file
+#endif // ERER_UTILS_LOADER_H_
@@ -0,0 +1,159 @@
+#ifndef ERER_UTILS_MAPPED_FILE_H_
+#define ERER_UTILS_MAPPED_FILE_H_
+
+#include <string>
+#include <utility> // for std::move
+#include <cstddef> // for size_t
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep std::min/std::max usable
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>    // for open
+#include <unistd.h>   // for close
+#include <sys/mman.h> // for mmap
+#include <sys/stat.h> // for fstat
+#endif
+
+namespace Utils
+{
+    // Read-only memory mapping of a whole file
+    class MappedFile
+    {
+    private:
+        const char *data_ = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        HANDLE file_ = INVALID_HANDLE_VALUE;
+        HANDLE mapping_ = nullptr;
+#endif
+
+    public:
+        MappedFile() = default;
+        MappedFile(const std::string &filename)
+        {
+            open(filename);
+        }
+        ~MappedFile()
+        {
+            close();
+        }
+
+        /* Move only */
+        MappedFile(const MappedFile &other) = delete;
+        MappedFile &operator=(const MappedFile &other) = delete;
+        MappedFile(MappedFile &&other) noexcept
+        {
+            *this = std::move(other);
+        }
+        MappedFile &operator=(MappedFile &&other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                data_ = other.data_;
+                size_ = other.size_;
+                other.data_ = nullptr;
+                other.size_ = 0;
+#ifdef _WIN32
+                file_ = other.file_;
+                mapping_ = other.mapping_;
+                other.file_ = INVALID_HANDLE_VALUE;
+                other.mapping_ = nullptr;
+#endif
+            }
+            return *this;
+        }
+
+        bool open(const std::string &filename)
+        {
+            close();
+#ifdef _WIN32
+            file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file_ == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+            {
+                close();
+                return false;
+            }
+            mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_ == nullptr)
+            {
+                close();
+                return false;
+            }
+            data_ = static_cast<const char *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            size_ = static_cast<size_t>(size.QuadPart);
+#else
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd); // the mapping keeps the file alive
+            if (p == MAP_FAILED)
+            {
+                return false;
+            }
+            data_ = static_cast<const char *>(p);
+            size_ = static_cast<size_t>(st.st_size);
+#endif
+            return data_ != nullptr;
+        }
+
+        void close()
+        {
+#ifdef _WIN32
+            if (data_ != nullptr)
+            {
+                UnmapViewOfFile(data_);
+            }
+            if (mapping_ != nullptr)
+            {
+                CloseHandle(mapping_);
+            }
+            if (file_ != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(file_);
+            }
+            mapping_ = nullptr;
+            file_ = INVALID_HANDLE_VALUE;
+#else
+            if (data_ != nullptr)
+            {
+                munmap(const_cast<char *>(data_), size_);
+            }
+#endif
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+        bool is_open() const
+        {
+            return data_ != nullptr;
+        }
+        const char *data() const
+        {
+            return data_;
+        }
+        size_t size() const
+        {
+            return size_;
+        }
+    };
+}
+
+#endif // ERER_UTILS_MAPPED_FILE_H_
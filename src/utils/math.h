@@ -5,8 +5,14 @@
 #include <random>
 #include <vector>
 #include <chrono>
+#include <cstring> // for memcpy
 
 #include "../settings.h"
+#include "../core/data_structure.hpp"
+
+#ifdef ERER_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace Utils
 {
@@ -21,7 +27,7 @@ namespace Utils
     typename T::type dot_product(const T &a, const T &b)
     {
         // assert(T::size() == 3 || T::size() == 2);
-        T::type ret = 0;
+        typename T::type ret = 0;
         for (int i = 0; i < T::size(); ++i)
         {
             ret += a[i] * b[i];
@@ -47,6 +53,40 @@ namespace Utils
         return Core::Vector4f{color[0] / 255.f, color[1] / 255.f, color[2] / 255.f, color[3] / 255.f};
     }
 
+    Core::Vector4f tone_mapping(const Core::RGBA8 &color)
+    {
+        Core::Vector4f ret;
+#ifdef ERER_USE_SSE2
+        int packed;
+        memcpy(&packed, color.rgba, 4);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i i32 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+        _mm_storeu_ps(&ret[0], _mm_mul_ps(_mm_cvtepi32_ps(i32), _mm_set1_ps(1.f / 255.f)));
+#else
+        for (int i = 4; i--; ret[i] = color[i] / 255.f)
+            ;
+#endif
+        return ret;
+    }
+
+    // Saturate a linear rgb color to [0,1] and pack it to 8 bits per channel
+    Core::RGBA8 inverse_tone_mapping(const Core::Vector3f &color, uint8_t alpha = 255)
+    {
+        Core::RGBA8 ret;
+#ifdef ERER_USE_SSE2
+        __m128 f = _mm_setr_ps(color[0], color[1], color[2], 0.f);
+        f = _mm_mul_ps(_mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.f)), _mm_set1_ps(255.f));
+        __m128i i16 = _mm_packs_epi32(_mm_cvttps_epi32(f), _mm_setzero_si128());
+        int packed = _mm_cvtsi128_si32(_mm_packus_epi16(i16, i16));
+        memcpy(ret.rgba, &packed, 4);
+#else
+        for (int i = 3; i--; ret[i] = static_cast<uint8_t>(saturate(color[i]) * 255))
+            ;
+#endif
+        ret[3] = alpha;
+        return ret;
+    }
+
     namespace Random
     {
         std::default_random_engine generator;
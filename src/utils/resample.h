@@ -0,0 +1,53 @@
+#ifndef ERER_UTILS_RESAMPLE_H_
+#define ERER_UTILS_RESAMPLE_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "../core/data_structure.hpp"
+
+namespace Utils
+{
+    // Bilinear resize of packed rgba with 8-bit fixed point weights, pixel centers aligned
+    void resample_bilinear(const Core::RGBA8 *src, int sw, int sh, Core::RGBA8 *dst, int dw, int dh)
+    {
+        struct Tap
+        {
+            int i0, i1;
+            int f; // weight of i1 in 1/256
+        };
+        auto taps = [](int n_src, int n_dst)
+        {
+            std::vector<Tap> ret(n_dst);
+            float step = static_cast<float>(n_src) / n_dst;
+            for (int i = 0; i < n_dst; ++i)
+            {
+                float s = std::max(0.f, (i + 0.5f) * step - 0.5f);
+                int i0 = std::min(static_cast<int>(s), n_src - 1);
+                ret[i] = {i0, std::min(i0 + 1, n_src - 1), static_cast<int>((s - i0) * 256)};
+            }
+            return ret;
+        };
+        std::vector<Tap> xs = taps(sw, dw);
+        std::vector<Tap> ys = taps(sh, dh);
+        for (int y = 0; y < dh; ++y)
+        {
+            const Core::RGBA8 *r0 = src + static_cast<size_t>(ys[y].i0) * sw;
+            const Core::RGBA8 *r1 = src + static_cast<size_t>(ys[y].i1) * sw;
+            int fy = ys[y].f;
+            Core::RGBA8 *out = dst + static_cast<size_t>(y) * dw;
+            for (int x = 0; x < dw; ++x)
+            {
+                const Tap &t = xs[x];
+                for (int c = 0; c < 4; ++c)
+                {
+                    int top = r0[t.i0][c] * (256 - t.f) + r0[t.i1][c] * t.f;
+                    int bottom = r1[t.i0][c] * (256 - t.f) + r1[t.i1][c] * t.f;
+                    out[x].rgba[c] = static_cast<uint8_t>((top * (256 - fy) + bottom * fy + (1 << 15)) >> 16);
+                }
+            }
+        }
+    }
+}
+
+#endif // ERER_UTILS_RESAMPLE_H_
@@ -0,0 +1,134 @@
+#ifndef ERER_UTILS_TGA_READER_H_
+#define ERER_UTILS_TGA_READER_H_
+
+#include <iostream>
+#include <string>
+#include <algorithm> // for std::fill_n std::reverse
+#include <cstring>   // for memcpy
+
+#include "../core/data_structure.hpp"
+#include "../core/image.h"
+#include "./mapped_file.h"
+#include "./tgaimage.h"
+#include "./convert.h"
+
+namespace Utils
+{
+    // Decode a tga straight into packed rgba rows stored top-down, the same orientation TGAImage
+    // produces. The file is memory-mapped, rle packets expand with bulk copies and fills, and the
+    // bottom-left origin flip is done by choosing the destination row while decoding. The image is
+    // converted to `layout` once, here, so sampling never pays for it.
+    bool read_tga_image(const std::string &filename, Core::Image<Core::RGBA8> *img_p, Core::ImageLayout layout = Core::ImageLayout::Linear)
+    {
+        MappedFile file(filename);
+        if (!file.is_open() || file.size() < sizeof(TGA_Header))
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return false;
+        }
+        TGA_Header header;
+        memcpy(&header, file.data(), sizeof(header));
+        const int w = header.width;
+        const int h = header.height;
+        const int bytespp = header.bitsperpixel >> 3;
+        if (w <= 0 || h <= 0 || (bytespp != TGAImage::GRAYSCALE && bytespp != TGAImage::RGB && bytespp != TGAImage::RGBA))
+        {
+            std::cerr << "bad bpp (or width/height) value\n";
+            return false;
+        }
+        const bool rle = header.datatypecode == 10 || header.datatypecode == 11;
+        if (!rle && header.datatypecode != 2 && header.datatypecode != 3)
+        {
+            std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+            return false;
+        }
+
+        const uint8_t *src = reinterpret_cast<const uint8_t *>(file.data()) + sizeof(header) + header.idlength;
+        if (header.colormaptype)
+        {
+            src += header.colormaplength * ((header.colormapdepth + 7) >> 3); // unused palette
+        }
+        const uint8_t *end = reinterpret_cast<const uint8_t *>(file.data()) + file.size();
+
+        Core::Image<Core::RGBA8> img(w, h);
+        const bool bottom_up = !(header.imagedescriptor & 0x20);
+        auto row = [&](int y)
+        { return img.data() + static_cast<size_t>(bottom_up ? h - 1 - y : y) * w; };
+
+        if (!rle)
+        {
+            if (end - src < static_cast<ptrdiff_t>(w) * h * bytespp)
+            {
+                std::cerr << "an error occured while reading the data\n";
+                return false;
+            }
+            for (int y = 0; y < h; ++y, src += static_cast<size_t>(w) * bytespp)
+            {
+                expand_to_rgba(src, bytespp, row(y), w);
+            }
+        }
+        else
+        {
+            int x = 0, y = 0;
+            while (y < h)
+            {
+                if (src >= end)
+                {
+                    std::cerr << "an error occured while reading the data\n";
+                    return false;
+                }
+                uint8_t chunkheader = *src++;
+                int count = (chunkheader & 0x7F) + 1;
+                bool run = chunkheader & 0x80;
+                if (end - src < (run ? 1 : count) * bytespp)
+                {
+                    std::cerr << "an error occured while reading the data\n";
+                    return false;
+                }
+                Core::RGBA8 color;
+                if (run)
+                {
+                    expand_to_rgba(src, bytespp, &color, 1);
+                    src += bytespp;
+                }
+                while (count > 0) // packets may cross scanlines
+                {
+                    if (y >= h)
+                    {
+                        std::cerr << "Too many pixels read\n";
+                        return false;
+                    }
+                    int n = std::min(count, w - x);
+                    if (run)
+                    {
+                        std::fill_n(row(y) + x, n, color);
+                    }
+                    else
+                    {
+                        expand_to_rgba(src, bytespp, row(y) + x, n);
+                        src += static_cast<size_t>(n) * bytespp;
+                    }
+                    count -= n;
+                    x += n;
+                    if (x == w)
+                    {
+                        x = 0;
+                        ++y;
+                    }
+                }
+            }
+        }
+        if (header.imagedescriptor & 0x10) // right-to-left, rare enough for a separate pass
+        {
+            for (int y = 0; y < h; ++y)
+            {
+                std::reverse(row(y), row(y) + w);
+            }
+        }
+        img.to_layout(layout);
+        *img_p = std::move(img);
+        return true;
+    }
+}
+
+#endif // ERER_UTILS_TGA_READER_H_
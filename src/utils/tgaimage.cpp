@@ -266,7 +266,7 @@ namespace Utils
         memcpy(data_.data() + (x + y * width_) * bytespp_, c.bgra, bytespp_);
     }
 
-    int TGAImage::get_bytespp()
+    int TGAImage::get_bytespp() const
     {
         return bytespp_;
     }
@@ -320,6 +320,11 @@ namespace Utils
         return data_.data();
     }
 
+    const std::uint8_t *TGAImage::buffer() const
+    {
+        return data_.data();
+    }
+
     void TGAImage::clear()
     {
         data_ = std::vector<std::uint8_t>(width_ * height_ * bytespp_, 0);
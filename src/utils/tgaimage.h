@@ -82,8 +82,9 @@ namespace Utils
         void set(const int x, const int y, const TGAColor &c);
         int get_width() const;
         int get_height() const;
-        int get_bytespp();
+        int get_bytespp() const;
         std::uint8_t *buffer();
+        const std::uint8_t *buffer() const;
         void clear();
         void write_data(const int w, const int h, const int bpp, uint8_t *data);
     };
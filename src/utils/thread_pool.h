@@ -0,0 +1,93 @@
+#ifndef ERER_UTILS_THREAD_POOL_H_
+#define ERER_UTILS_THREAD_POOL_H_
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+
+namespace Utils
+{
+    // Fixed set of worker threads consuming a FIFO task queue
+    class ThreadPool
+    {
+    private:
+        std::vector<std::thread> workers_;
+        std::queue<std::function<void()>> tasks_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stop_ = false;
+
+    public:
+        ThreadPool(int num_threads = 0)
+        {
+            if (num_threads <= 0)
+            {
+                num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            }
+            for (int i = 0; i < num_threads; ++i)
+            {
+                workers_.emplace_back([this]()
+                                      {
+                                          for (;;)
+                                          {
+                                              std::function<void()> task;
+                                              {
+                                                  std::unique_lock<std::mutex> lock(mutex_);
+                                                  cv_.wait(lock, [this]()
+                                                           { return stop_ || !tasks_.empty(); });
+                                                  if (stop_ && tasks_.empty())
+                                                  {
+                                                      return;
+                                                  }
+                                                  task = std::move(tasks_.front());
+                                                  tasks_.pop();
+                                              }
+                                              task();
+                                          } });
+            }
+        }
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (auto &w : workers_)
+            {
+                w.join();
+            }
+        }
+        ThreadPool(const ThreadPool &other) = delete;
+        ThreadPool &operator=(const ThreadPool &other) = delete;
+
+        template <typename F>
+        std::future<std::invoke_result_t<F>> submit(F &&f)
+        {
+            using R = std::invoke_result_t<F>;
+            auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f)); // std::function needs a copyable target
+            std::future<R> ret = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tasks_.emplace([task]()
+                               { (*task)(); });
+            }
+            cv_.notify_one();
+            return ret;
+        }
+
+        int size() const
+        {
+            return static_cast<int>(workers_.size());
+        }
+    };
+}
+
+#endif // ERER_UTILS_THREAD_POOL_H_
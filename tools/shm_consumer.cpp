@@ -0,0 +1,88 @@
+// Reference consumer of the shared memory frame ring written by ERer_headless --shm NAME.
+// Reads every frame in place, prints a short summary and optionally saves the first one as tga.
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+
+#include "../src/utils/frame_sink.h"
+#include "../src/utils/convert.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cout << "Usage: shm_consumer NAME [--frames N] [--save FILE] [--timeout SEC]" << endl;
+        return 1;
+    }
+    string name = argv[1];
+    long max_frames = -1;
+    string save_path;
+    double timeout = 10.;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        string arg = argv[i];
+        if (arg == "--frames")
+            max_frames = atol(argv[i + 1]);
+        else if (arg == "--save")
+            save_path = argv[i + 1];
+        else if (arg == "--timeout")
+            timeout = atof(argv[i + 1]);
+    }
+
+    // The producer may start after us
+    Utils::ShmFrameSource source;
+    auto start = chrono::steady_clock::now();
+    while (!source.open(name))
+    {
+        if (chrono::duration<double>(chrono::steady_clock::now() - start).count() > timeout)
+        {
+            cerr << "No frame ring named " << name << endl;
+            return 1;
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+
+    long count = 0;
+    Utils::ShmFrameSource::Frame frame;
+    while (max_frames < 0 || count < max_frames)
+    {
+        if (!source.peek(&frame))
+        {
+            if (source.is_closed())
+            {
+                break; // published frames are drained and no more will come
+            }
+            this_thread::sleep_for(chrono::microseconds(200));
+            continue;
+        }
+
+        size_t n = static_cast<size_t>(frame.width) * frame.height;
+        uint64_t sum[3] = {0, 0, 0};
+        float min_dp = frame.depth[0], max_dp = frame.depth[0];
+        for (size_t i = 0; i < n; ++i)
+        {
+            sum[0] += frame.color[i][0];
+            sum[1] += frame.color[i][1];
+            sum[2] += frame.color[i][2];
+            min_dp = std::min(min_dp, frame.depth[i]);
+            max_dp = std::max(max_dp, frame.depth[i]);
+        }
+        cout << "Frame " << frame.frame << " at " << frame.time << " s: " << frame.width << "x" << frame.height
+             << ", mean rgb (" << sum[0] / n << ", " << sum[1] / n << ", " << sum[2] / n << ")"
+             << ", depth [" << min_dp << ", " << max_dp << "]" << endl;
+        if (!save_path.empty() && count == 0)
+        {
+            Utils::TGAImage img = Utils::convert_raw_data_to_TGAImage(reinterpret_cast<const uint8_t *>(frame.color), frame.width, frame.height, 4);
+            img.write_tga_file(save_path);
+        }
+        source.release();
+        ++count;
+    }
+    cout << "Consumed " << count << " frame(s)" << endl;
+    return 0;
+}